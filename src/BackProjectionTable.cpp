@@ -0,0 +1,25 @@
+#include "BackProjectionTable.h"
+
+bool BackProjectionTable::setup(int width, int height, double fx, double fy, double cx, double cy)
+{
+	if(width == width_ && height == height_
+		&& fx == fx_ && fy == fy_ && cx == cx_ && cy == cy_)
+		return false;
+
+	width_ = width;
+	height_ = height;
+	fx_ = fx;
+	fy_ = fy;
+	cx_ = cx;
+	cy_ = cy;
+
+	raysX_.resize(width);
+	for(int x = 0; x < width; x++)
+		raysX_[x] = static_cast<float>((static_cast<double>(x) - cx) / fx);
+
+	raysY_.resize(height);
+	for(int y = 0; y < height; y++)
+		raysY_[y] = static_cast<float>((static_cast<double>(y) - cy) / fy);
+
+	return true;
+}
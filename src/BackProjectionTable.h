@@ -0,0 +1,41 @@
+#ifndef BACKPROJECTIONTABLE_H
+#define BACKPROJECTIONTABLE_H
+
+#include <vector>
+
+/**
+ * Precomputed ray directions for converting depth pixels to 3D points.
+ *
+ * For a pinhole camera, the ray of pixel (x, y) is ((x - cx)/fx, (y - cy)/fy, 1),
+ * which is separable into one factor per column and one per row. A depth value z
+ * at (x, y) is then back-projected to (getRaysX()[x] * z, getRaysY()[y] * z, z),
+ * one multiply per coordinate and a contiguous array per row.
+ *
+ * The table is only recomputed if the resolution or the intrinsics change.
+ */
+class BackProjectionTable
+{
+public:
+	BackProjectionTable() { }
+
+	/**
+	 * Sets up the table, returns true if it had to be recomputed.
+	 */
+	bool setup(int width, int height, double fx, double fy, double cx, double cy);
+
+	bool isValid() const { return width_ > 0 && height_ > 0; }
+
+	int getWidth() const { return width_; }
+	int getHeight() const { return height_; }
+
+	const float *getRaysX() const { return raysX_.data(); }
+	const float *getRaysY() const { return raysY_.data(); }
+
+private:
+	int width_{ 0 }, height_{ 0 };
+	double fx_{ 0 }, fy_{ 0 }, cx_{ 0 }, cy_{ 0 };
+
+	std::vector<float> raysX_, raysY_;
+};
+
+#endif
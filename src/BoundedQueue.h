@@ -0,0 +1,117 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <utility>
+
+/**
+ * Blocking FIFO queue with a fixed capacity, connecting two pipeline stages.
+ *
+ * After close(), push() fails and pop() returns the remaining items, then fails.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity)
+		: capacity_(capacity), closed_(false)
+	{
+	}
+
+	/**
+	 * Appends an item, blocks while the queue is full.
+	 *
+	 * Returns false if the queue has been closed.
+	 */
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while(queue_.size() >= capacity_ && !closed_)
+			notFull_.wait(lock);
+		if(closed_)
+			return false;
+		queue_.push_back(std::move(item));
+		notEmpty_.notify_one();
+		return true;
+	}
+
+	/**
+	 * Appends an item if there is room, never blocks.
+	 */
+	bool tryPush(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if(queue_.size() >= capacity_ || closed_)
+			return false;
+		queue_.push_back(std::move(item));
+		notEmpty_.notify_one();
+		return true;
+	}
+
+	/**
+	 * Appends an item, never blocks; if the queue is full, the oldest items are removed.
+	 *
+	 * Returns false if the queue has been closed. numDropped is set to the number of removed items.
+	 */
+	bool pushDropOldest(T item, size_t &numDropped)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		numDropped = 0;
+		if(closed_)
+			return false;
+		while(queue_.size() >= capacity_ && !queue_.empty())
+		{
+			queue_.pop_front();
+			numDropped++;
+		}
+		queue_.push_back(std::move(item));
+		notEmpty_.notify_one();
+		return true;
+	}
+
+	/**
+	 * Removes the oldest item, blocks while the queue is empty.
+	 *
+	 * Returns false if the queue has been closed and is empty.
+	 */
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while(queue_.empty() && !closed_)
+			notEmpty_.wait(lock);
+		if(queue_.empty())
+			return false;
+		item = std::move(queue_.front());
+		queue_.pop_front();
+		notFull_.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		closed_ = true;
+		notEmpty_.notify_all();
+		notFull_.notify_all();
+	}
+
+	size_t size() const
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		return queue_.size();
+	}
+
+	size_t capacity() const { return capacity_; }
+
+private:
+	mutable std::mutex mutex_;
+	std::condition_variable notEmpty_, notFull_;
+	std::deque<T> queue_;
+	size_t capacity_;
+	bool closed_;
+};
+
+#endif
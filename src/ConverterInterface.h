@@ -1,6 +1,8 @@
 #ifndef CONVERTERINTERFACE_H
 #define CONVERTERINTERFACE_H
 
+#include "FrameHandle.h"
+
 namespace openni
 {
 	class VideoStream;
@@ -18,10 +20,22 @@ public:
 	virtual void setup(StitcherI* pStitcher) = 0;
 	virtual void cleanup() = 0;
 
-	virtual void newColorFrame(int frameIndex, int width, int height, int stride, int size, const void* data,
-		const openni::VideoStream* pVS) = 0;
-	virtual void newDepthFrame(int frameIndex, int width, int height, int stride, int size, const void* data,
-		const openni::VideoStream* pVS) = 0;
+	/**
+	 * Called on the driver's callback thread with a handle shared by all converters.
+	 *
+	 * Converters may keep a copy of the handle instead of copying the pixel data,
+	 * but should not hold it longer than needed, as it might pin a driver buffer.
+	 *
+	 * pVS is nullptr for frames that do not come from OpenNI (replayed image sequences).
+	 */
+	virtual void newColorFrame(const FrameHandle &frame, const openni::VideoStream* pVS) = 0;
+	virtual void newDepthFrame(const FrameHandle &frame, const openni::VideoStream* pVS) = 0;
+
+	/**
+	 * True while new frames might be dropped. Sources that can wait, like a
+	 * replay at full speed, hold back the next frame until this is false.
+	 */
+	virtual bool isBacklogged() const { return false; }
 };
 
 #endif
@@ -0,0 +1,292 @@
+#include "DepthToPointCloud.h"
+#include "BackProjectionTable.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#	define DEPTHTOPOINTCLOUD_X86
+#	include <immintrin.h>
+#	if defined(_MSC_VER) && !defined(__clang__)
+#		include <intrin.h>
+#		define TARGET_SSE41
+#		define TARGET_AVX2
+#	else
+#		define TARGET_SSE41 __attribute__((target("sse4.1")))
+#		define TARGET_AVX2 __attribute__((target("avx2")))
+#	endif
+#endif
+
+namespace
+{
+	// The vector kernels always store a full register, even if fewer points are valid
+	const size_t paddingPoints = 8;
+
+	typedef size_t (*ConvertRowFunc)(const uint16_t *pDepth, const uint8_t *pColor, const uint8_t *pColorEnd,
+		const float *pRaysX, float rayY, float depthFactor, int xStart, int width,
+		float *pX, float *pY, float *pZ, uint32_t *pRGBA);
+
+	inline uint32_t packRGBA(const uint8_t *pColor)
+	{
+		const uint8_t rgba[4] = { pColor[0], pColor[1], pColor[2], 255 };
+		uint32_t packed;
+		memcpy(&packed, rgba, sizeof(packed));
+		return packed;
+	}
+
+	size_t convertRowScalar(const uint16_t *pDepth, const uint8_t *pColor, const uint8_t *pColorEnd,
+		const float *pRaysX, float rayY, float depthFactor, int xStart, int width,
+		float *pX, float *pY, float *pZ, uint32_t *pRGBA)
+	{
+		size_t n = 0;
+		for(int x = xStart; x < width; x++)
+		{
+			if(pDepth[x] > 0)
+			{
+				const float z = static_cast<float>(pDepth[x]) * depthFactor;
+				pX[n] = pRaysX[x] * z;
+				pY[n] = rayY * z;
+				pZ[n] = z;
+				pRGBA[n] = packRGBA(pColor + 3 * x);
+				n++;
+			}
+		}
+		return n;
+	}
+
+#if defined(DEPTHTOPOINTCLOUD_X86)
+	/**
+	 * For each validity mask, the indices of the valid lanes, moved to the front.
+	 */
+	struct CompactionTable
+	{
+		CompactionTable()
+		{
+			for(int mask = 0; mask < 256; mask++)
+			{
+				int n = 0;
+				for(int lane = 0; lane < 8; lane++)
+				{
+					if(mask & (1 << lane))
+						lanes[mask][n++] = lane;
+				}
+				counts[mask] = n;
+				for(int i = n; i < 8; i++)
+					lanes[mask][i] = 0;
+
+				// Byte shuffle for 4 lanes of 32 bit, unused bytes are zeroed
+				if(mask < 16)
+				{
+					for(int i = 0; i < 16; i++)
+						bytes[mask][i] = static_cast<int8_t>(-1);
+					for(int i = 0; i < n; i++)
+					{
+						for(int b = 0; b < 4; b++)
+							bytes[mask][4 * i + b] = static_cast<int8_t>(4 * lanes[mask][i] + b);
+					}
+				}
+			}
+		}
+
+		int32_t lanes[256][8];
+		int counts[256];
+		int8_t bytes[16][16];
+	};
+
+	const CompactionTable &getCompactionTable()
+	{
+		static const CompactionTable table;
+		return table;
+	}
+
+	TARGET_SSE41 size_t convertRowSSE41(const uint16_t *pDepth, const uint8_t *pColor, const uint8_t *pColorEnd,
+		const float *pRaysX, float rayY, float depthFactor, int xStart, int width,
+		float *pX, float *pY, float *pZ, uint32_t *pRGBA)
+	{
+		const CompactionTable &table = getCompactionTable();
+		const __m128 factor = _mm_set1_ps(depthFactor);
+		const __m128 rayYVec = _mm_set1_ps(rayY);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rgbToRGBA = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+		size_t n = 0;
+		int x = xStart;
+		// The color load reads 16 bytes for 4 pixels (12 bytes), stay inside the image
+		for(; x + 4 <= width && pColor + 3 * x + 16 <= pColorEnd; x += 4)
+		{
+			const __m128i depth = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(pDepth + x)));
+			const int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(depth, zero)));
+			if(mask == 0)
+				continue;
+
+			const __m128 z = _mm_mul_ps(_mm_cvtepi32_ps(depth), factor);
+			const __m128 wx = _mm_mul_ps(_mm_loadu_ps(pRaysX + x), z);
+			const __m128 wy = _mm_mul_ps(rayYVec, z);
+			const __m128i rgba = _mm_or_si128(
+				_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pColor + 3 * x)), rgbToRGBA),
+				alpha);
+
+			const __m128i compact = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.bytes[mask]));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pX + n), _mm_shuffle_epi8(_mm_castps_si128(wx), compact));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pY + n), _mm_shuffle_epi8(_mm_castps_si128(wy), compact));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pZ + n), _mm_shuffle_epi8(_mm_castps_si128(z), compact));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(pRGBA + n), _mm_shuffle_epi8(rgba, compact));
+			n += table.counts[mask];
+		}
+
+		return n + convertRowScalar(pDepth, pColor, pColorEnd, pRaysX, rayY, depthFactor, x, width,
+			pX + n, pY + n, pZ + n, pRGBA + n);
+	}
+
+	TARGET_AVX2 size_t convertRowAVX2(const uint16_t *pDepth, const uint8_t *pColor, const uint8_t *pColorEnd,
+		const float *pRaysX, float rayY, float depthFactor, int xStart, int width,
+		float *pX, float *pY, float *pZ, uint32_t *pRGBA)
+	{
+		const CompactionTable &table = getCompactionTable();
+		const __m256 factor = _mm256_set1_ps(depthFactor);
+		const __m256 rayYVec = _mm256_set1_ps(rayY);
+		const __m256i zero = _mm256_setzero_si256();
+		const __m128i rgbToRGBA = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+		size_t n = 0;
+		int x = xStart;
+		// The second color load reads 16 bytes from the 5th pixel on, stay inside the image
+		for(; x + 8 <= width && pColor + 3 * x + 28 <= pColorEnd; x += 8)
+		{
+			const __m256i depth = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pDepth + x)));
+			const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(depth, zero)));
+			if(mask == 0)
+				continue;
+
+			const __m256 z = _mm256_mul_ps(_mm256_cvtepi32_ps(depth), factor);
+			const __m256 wx = _mm256_mul_ps(_mm256_loadu_ps(pRaysX + x), z);
+			const __m256 wy = _mm256_mul_ps(rayYVec, z);
+
+			const uint8_t *pCurColor = pColor + 3 * x;
+			const __m128i rgbaLow = _mm_or_si128(
+				_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pCurColor)), rgbToRGBA),
+				alpha);
+			const __m128i rgbaHigh = _mm_or_si128(
+				_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pCurColor + 12)), rgbToRGBA),
+				alpha);
+			const __m256i rgba = _mm256_inserti128_si256(_mm256_castsi128_si256(rgbaLow), rgbaHigh, 1);
+
+			const __m256i compact = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.lanes[mask]));
+			_mm256_storeu_ps(pX + n, _mm256_permutevar8x32_ps(wx, compact));
+			_mm256_storeu_ps(pY + n, _mm256_permutevar8x32_ps(wy, compact));
+			_mm256_storeu_ps(pZ + n, _mm256_permutevar8x32_ps(z, compact));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(pRGBA + n), _mm256_permutevar8x32_epi32(rgba, compact));
+			n += table.counts[mask];
+		}
+
+		return n + convertRowScalar(pDepth, pColor, pColorEnd, pRaysX, rayY, depthFactor, x, width,
+			pX + n, pY + n, pZ + n, pRGBA + n);
+	}
+
+	bool cpuSupportsSSE41()
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 19)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse4.1") != 0;
+#endif
+	}
+
+	bool cpuSupportsAVX2()
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		if(info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		if(!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+#endif
+
+	struct RowFunction
+	{
+		RowFunction()
+			: func(&convertRowScalar), name("scalar")
+		{
+#if defined(DEPTHTOPOINTCLOUD_X86)
+			if(cpuSupportsAVX2())
+			{
+				func = &convertRowAVX2;
+				name = "AVX2";
+			}
+			else if(cpuSupportsSSE41())
+			{
+				func = &convertRowSSE41;
+				name = "SSE4.1";
+			}
+#endif
+		}
+
+		ConvertRowFunc func;
+		const char *name;
+	};
+
+	const RowFunction &getRowFunction()
+	{
+		static const RowFunction rowFunction;
+		return rowFunction;
+	}
+}
+
+void PointCloudSoA::reserve(size_t numPoints)
+{
+	if(x_.size() < numPoints + paddingPoints)
+	{
+		x_.resize(numPoints + paddingPoints);
+		y_.resize(numPoints + paddingPoints);
+		z_.resize(numPoints + paddingPoints);
+		rgba_.resize(numPoints + paddingPoints);
+	}
+}
+
+void DepthToPointCloud::convert(const uint16_t *pDepth, int depthStride,
+	const uint8_t *pColor, int colorStride,
+	const BackProjectionTable &rays, float depthFactor,
+	PointCloudSoA &pointCloud)
+{
+	const int width = rays.getWidth(), height = rays.getHeight();
+	pointCloud.clear();
+	if(width <= 0 || height <= 0)
+		return;
+
+	pointCloud.reserve(static_cast<size_t>(width) * height);
+
+	const ConvertRowFunc convertRow = getRowFunction().func;
+	const uint8_t *pColorEnd = pColor + static_cast<ptrdiff_t>(height - 1) * colorStride + 3 * width;
+	const float *pRaysX = rays.getRaysX(), *pRaysY = rays.getRaysY();
+
+	size_t n = 0;
+	for(int y = 0; y < height; y++)
+	{
+		n += convertRow(pDepth + static_cast<ptrdiff_t>(y) * depthStride,
+			pColor + static_cast<ptrdiff_t>(y) * colorStride, pColorEnd,
+			pRaysX, pRaysY[y], depthFactor, 0, width,
+			pointCloud.x_.data() + n, pointCloud.y_.data() + n,
+			pointCloud.z_.data() + n, pointCloud.rgba_.data() + n);
+	}
+	pointCloud.size_ = n;
+}
+
+const char *DepthToPointCloud::getInstructionSet()
+{
+	return getRowFunction().name;
+}
@@ -0,0 +1,71 @@
+#ifndef DEPTHTOPOINTCLOUD_H
+#define DEPTHTOPOINTCLOUD_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class BackProjectionTable;
+
+/**
+ * Point cloud in structure-of-arrays layout.
+ *
+ * Each color is packed as the bytes R, G, B, A in memory, matching an
+ * RGBA8 vertex attribute. The arrays are never shrunk, only the first
+ * size() entries are valid.
+ */
+class PointCloudSoA
+{
+public:
+	PointCloudSoA() { }
+
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	const float *getX() const { return x_.data(); }
+	const float *getY() const { return y_.data(); }
+	const float *getZ() const { return z_.data(); }
+	const uint32_t *getRGBA() const { return rgba_.data(); }
+
+	void clear() { size_ = 0; }
+
+private:
+	friend class DepthToPointCloud;
+
+	/**
+	 * Makes sure numPoints points fit, plus the padding needed by the vector kernels.
+	 */
+	void reserve(size_t numPoints);
+
+	std::vector<float> x_, y_, z_;
+	std::vector<uint32_t> rgba_;
+	size_t size_{ 0 };
+};
+
+/**
+ * Converts a 16 bit depth image and an RGB888 color image into a point cloud.
+ *
+ * Pixels with depth 0 are skipped. Uses AVX2 or SSE4.1 if the CPU supports
+ * it (detected at runtime), otherwise a scalar implementation.
+ */
+class DepthToPointCloud
+{
+public:
+	/**
+	 * @param pDepth First depth pixel, depthStride is the distance between lines in pixels.
+	 * @param pColor First color pixel, colorStride is the distance between lines in bytes.
+	 * @param depthFactor Multiplied with the raw depth values, e.g. 1/depthScale for metres.
+	 * @param rays Back-projection table with the same resolution as the images.
+	 */
+	static void convert(const uint16_t *pDepth, int depthStride,
+		const uint8_t *pColor, int colorStride,
+		const BackProjectionTable &rays, float depthFactor,
+		PointCloudSoA &pointCloud);
+
+	/**
+	 * Name of the instruction set used by convert(), for logging.
+	 */
+	static const char *getInstructionSet();
+};
+
+#endif
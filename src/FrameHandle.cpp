@@ -0,0 +1,118 @@
+#include "FrameHandle.h"
+
+#include <cstring>
+
+// Workaround for MinGW
+#if defined(_WIN32) && !defined(_MSC_VER)
+#	define _MSC_VER 1300
+#endif
+#include <OpenNI.h>
+
+std::atomic<int> FrameHandle::numberOfDriverFrames_{ 0 };
+
+/**
+ * Keeps a driver frame alive by holding a reference to it.
+ */
+class FrameHandle::VideoFrameRefBuffer : public FrameBuffer
+{
+public:
+	explicit VideoFrameRefBuffer(const openni::VideoFrameRef &frame)
+		: frame_(frame)
+	{
+		numberOfDriverFrames_++;
+	}
+	virtual ~VideoFrameRefBuffer()
+	{
+		frame_.release();
+		numberOfDriverFrames_--;
+	}
+
+	virtual const void *getData() const { return frame_.getData(); }
+
+private:
+	openni::VideoFrameRef frame_;
+};
+
+/**
+ * Holds a buffer of a FramePool.
+ */
+class FrameHandle::PooledBuffer : public FrameBuffer
+{
+public:
+	explicit PooledBuffer(std::shared_ptr<std::vector<unsigned char> > buffer)
+		: buffer_(buffer)
+	{
+	}
+
+	virtual const void *getData() const { return buffer_->data(); }
+
+private:
+	std::shared_ptr<std::vector<unsigned char> > buffer_;
+};
+
+std::shared_ptr<std::vector<unsigned char> > FramePool::acquire(size_t size)
+{
+	std::unique_ptr<std::vector<unsigned char> > buffer;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if(!freeBuffers_.empty())
+		{
+			buffer = std::move(freeBuffers_.back());
+			freeBuffers_.pop_back();
+		}
+	}
+	if(!buffer)
+		buffer.reset(new std::vector<unsigned char>());
+	buffer->resize(size);
+
+	// The deleter hands the buffer back, or frees it if the pool is already gone
+	std::weak_ptr<FramePool> weakPool(shared_from_this());
+	return std::shared_ptr<std::vector<unsigned char> >(buffer.release(),
+		[weakPool](std::vector<unsigned char> *pBuffer)
+		{
+			std::shared_ptr<FramePool> pool = weakPool.lock();
+			if(pool)
+				pool->release(pBuffer);
+			else
+				delete pBuffer;
+		});
+}
+
+void FramePool::release(std::vector<unsigned char> *pBuffer)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if(freeBuffers_.size() < maxFreeBuffers_)
+		freeBuffers_.emplace_back(pBuffer);
+	else
+		delete pBuffer;
+}
+
+FrameHandle FrameHandle::fromVideoFrameRef(const openni::VideoFrameRef &frame)
+{
+	FrameHandle handle;
+	handle.buffer_ = std::make_shared<VideoFrameRefBuffer>(frame);
+	handle.frameIndex_ = frame.getFrameIndex();
+	handle.timestamp_ = frame.getTimestamp();
+	handle.width_ = frame.getWidth();
+	handle.height_ = frame.getHeight();
+	handle.stride_ = frame.getStrideInBytes();
+	handle.size_ = frame.getDataSize();
+	return handle;
+}
+
+FrameHandle FrameHandle::fromPool(FramePool &pool, int frameIndex, uint64_t timestamp,
+	int width, int height, int stride, int size, const void *data)
+{
+	std::shared_ptr<std::vector<unsigned char> > buffer = pool.acquire(size);
+	memcpy(buffer->data(), data, size);
+
+	FrameHandle handle;
+	handle.buffer_ = std::make_shared<PooledBuffer>(buffer);
+	handle.frameIndex_ = frameIndex;
+	handle.timestamp_ = timestamp;
+	handle.width_ = width;
+	handle.height_ = height;
+	handle.stride_ = stride;
+	handle.size_ = size;
+	return handle;
+}
@@ -0,0 +1,114 @@
+#ifndef FRAMEHANDLE_H
+#define FRAMEHANDLE_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+namespace openni
+{
+	class VideoFrameRef;
+};
+
+/**
+ * Memory holding the pixels of one frame.
+ *
+ * Either an OpenNI driver buffer (kept alive by a VideoFrameRef) or a buffer
+ * taken from a FramePool.
+ */
+class FrameBuffer
+{
+public:
+	FrameBuffer() { }
+	virtual ~FrameBuffer() { }
+
+	virtual const void *getData() const = 0;
+
+private:
+	FrameBuffer(const FrameBuffer &) = delete;
+	FrameBuffer &operator=(const FrameBuffer &) = delete;
+};
+
+/**
+ * Pool of equally sized frame buffers that are recycled instead of freed.
+ *
+ * Used when driver frames must not be held for long, the frame is then
+ * copied once into a pooled buffer and shared from there.
+ */
+class FramePool : public std::enable_shared_from_this<FramePool>
+{
+public:
+	static std::shared_ptr<FramePool> create() { return std::shared_ptr<FramePool>(new FramePool()); }
+
+	/**
+	 * Returns a buffer with at least size bytes.
+	 *
+	 * The buffer goes back to the pool when the last reference is released.
+	 */
+	std::shared_ptr<std::vector<unsigned char> > acquire(size_t size);
+
+private:
+	FramePool() { }
+
+	void release(std::vector<unsigned char> *pBuffer);
+
+	std::mutex mutex_;
+	std::vector<std::unique_ptr<std::vector<unsigned char> > > freeBuffers_;
+
+	static const size_t maxFreeBuffers_ = 8;
+};
+
+/**
+ * Ref-counted handle of one sensor frame.
+ *
+ * All converters receive the same handle, so a frame is never copied just
+ * to pass it along. Copying a FrameHandle only copies a shared_ptr.
+ */
+class FrameHandle
+{
+public:
+	FrameHandle() { }
+
+	/**
+	 * Wraps the driver's frame without copying the pixel data.
+	 *
+	 * The driver buffer stays alive as long as any copy of the handle exists.
+	 */
+	static FrameHandle fromVideoFrameRef(const openni::VideoFrameRef &frame);
+
+	/**
+	 * Copies the pixel data once into a buffer taken from the pool.
+	 */
+	static FrameHandle fromPool(FramePool &pool, int frameIndex, uint64_t timestamp,
+		int width, int height, int stride, int size, const void *data);
+
+	bool isValid() const { return buffer_ != nullptr; }
+
+	const void *getData() const { return buffer_ ? buffer_->getData() : nullptr; }
+	int getDataSize() const { return size_; }
+	int getFrameIndex() const { return frameIndex_; }
+	uint64_t getTimestamp() const { return timestamp_; }
+	int getWidth() const { return width_; }
+	int getHeight() const { return height_; }
+	int getStrideInBytes() const { return stride_; }
+
+	/**
+	 * Number of frames still referencing a driver buffer, over all handles.
+	 */
+	static int getNumberOfDriverFrames() { return numberOfDriverFrames_; }
+
+private:
+	class VideoFrameRefBuffer;
+	class PooledBuffer;
+
+	std::shared_ptr<const FrameBuffer> buffer_;
+	int frameIndex_{ 0 };
+	uint64_t timestamp_{ 0 };
+	int width_{ 0 }, height_{ 0 }, stride_{ 0 }, size_{ 0 };
+
+	static std::atomic<int> numberOfDriverFrames_;
+};
+
+#endif
@@ -0,0 +1,517 @@
+#include "FrameJournal.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// All values are stored in the byte order of the machine, i.e. little endian
+	const char fileMagic[8] = { 'R', 'G', 'B', 'D', 'J', 'N', 'L', '1' };
+	const uint32_t fileVersion = 2;
+	const size_t fileHeaderSize = 32, intrinsicSize = 4 * sizeof(double);	// Version 2 appends the intrinsics
+	const uint32_t frameTag = 0x454d5246;	// "FRME"
+	const uint32_t flagKeyframe = 1, flagTrackingFailed = 2;	// Older journals only know the first one
+	const size_t frameHeaderSize = 32 + (16 + 16 + 36) * sizeof(double);
+
+	template <typename T>
+	void put(std::vector<uint8_t> &buffer, const T &value)
+	{
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+		buffer.insert(buffer.end(), p, p + sizeof(T));
+	}
+
+	template <typename T>
+	T get(const uint8_t *&p)
+	{
+		T value;
+		std::memcpy(&value, p, sizeof(T));
+		p += sizeof(T);
+		return value;
+	}
+
+	template <typename Derived>
+	void putMatrix(std::vector<uint8_t> &buffer, const Eigen::MatrixBase<Derived> &matrix)
+	{
+		for(Eigen::Index i = 0; i < matrix.size(); i++)
+			put<double>(buffer, matrix(i));
+	}
+
+	template <typename Derived>
+	void getMatrix(const uint8_t *&p, Eigen::MatrixBase<Derived> &matrix)
+	{
+		for(Eigen::Index i = 0; i < matrix.size(); i++)
+			matrix(i) = get<double>(p);
+	}
+
+	struct FrameHeader
+	{
+		uint64_t timestamp;
+		uint32_t flags, colorCodec, colorSize, depthSize;
+	};
+
+	/**
+	 * Parses the fixed part of a frame record, p is advanced to the poses.
+	 */
+	bool readFrameHeader(const uint8_t *&p, FrameHeader &header)
+	{
+		if(get<uint32_t>(p) != frameTag)
+			return false;
+		get<uint32_t>(p);	// reserved
+		header.timestamp = get<uint64_t>(p);
+		header.flags = get<uint32_t>(p);
+		header.colorCodec = get<uint32_t>(p);
+		header.colorSize = get<uint32_t>(p);
+		header.depthSize = get<uint32_t>(p);
+		return true;
+	}
+}
+
+FrameJournalWriter::FrameJournalWriter()
+{
+}
+
+FrameJournalWriter::~FrameJournalWriter()
+{
+	close();
+}
+
+bool FrameJournalWriter::open(const std::string &filename, int width, int height, double depthScale,
+	const open3d::camera::PinholeCameraIntrinsic &intrinsic, ColorCodec colorCodec)
+{
+	close();
+
+	file_.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!file_.is_open())
+	{
+		std::cerr << "FrameJournal: Could not create " << filename << std::endl;
+		return false;
+	}
+
+	filename_ = filename;
+	depthScale_ = depthScale;
+	colorCodec_ = colorCodec;
+	writtenFrames_ = 0;
+	hasFailed_ = false;
+
+	std::vector<uint8_t> header(fileMagic, fileMagic + sizeof(fileMagic));
+	put<uint32_t>(header, fileVersion);
+	put<int32_t>(header, width);
+	put<int32_t>(header, height);
+	put<uint32_t>(header, 0);	// reserved
+	put<double>(header, depthScale);
+	const auto focalLength = intrinsic.GetFocalLength();
+	const auto principalPoint = intrinsic.GetPrincipalPoint();
+	put<double>(header, focalLength.first);
+	put<double>(header, focalLength.second);
+	put<double>(header, principalPoint.first);
+	put<double>(header, principalPoint.second);
+	file_.write(reinterpret_cast<const char *>(header.data()), header.size());
+	file_.flush();
+	if(!file_)
+	{
+		std::cerr << "FrameJournal: Could not write to " << filename << std::endl;
+		file_.close();
+		return false;
+	}
+
+	// Unbounded, so the scan never waits for the disk and no frame is left out
+	queue_ = std::make_unique<BoundedQueue<std::shared_ptr<const JournalFrame> > >(std::numeric_limits<size_t>::max());
+	writerThread_ = std::thread(&FrameJournalWriter::writerEntry, this);
+	return true;
+}
+
+bool FrameJournalWriter::append(const std::shared_ptr<const JournalFrame> &frame)
+{
+	if(!queue_)
+		return false;
+	return queue_->push(frame);
+}
+
+void FrameJournalWriter::close()
+{
+	if(!queue_)
+		return;
+
+	queue_->close();
+	writerThread_.join();
+	queue_.reset();
+	file_.close();
+}
+
+void FrameJournalWriter::writerEntry()
+{
+	std::shared_ptr<const JournalFrame> frame;
+	while(queue_->pop(frame))
+	{
+		if(!writeFrame(*frame))
+		{
+			// Later frames cannot be written either, the records must stay in order
+			std::cerr << "FrameJournal: Could not write to " << filename_ << std::endl;
+			hasFailed_ = true;
+			while(queue_->pop(frame)) { }
+			return;
+		}
+		writtenFrames_++;
+	}
+}
+
+bool FrameJournalWriter::writeFrame(const JournalFrame &frame)
+{
+	const open3d::geometry::RGBDImage &image = *frame.image;
+
+	// The float depth was converted from 16 bit values, so this is lossless
+	cv::Mat depth16(image.depth_.height_, image.depth_.width_, CV_16UC1);
+	for(int y = 0; y < depth16.rows; y++)
+	{
+		const float *pSrc = reinterpret_cast<const float *>(image.depth_.data_.data()) + static_cast<size_t>(y) * depth16.cols;
+		uint16_t *pDst = depth16.ptr<uint16_t>(y);
+		for(int x = 0; x < depth16.cols; x++)
+		{
+			const double value = std::isnan(pSrc[x]) ? 0.0 : std::round(pSrc[x] * depthScale_);
+			pDst[x] = static_cast<uint16_t>(std::min(std::max(value, 0.0), 65535.0));
+		}
+	}
+
+	std::vector<uchar> depthBuffer, colorBuffer;
+	if(!cv::imencode(".png", depth16, depthBuffer, { cv::IMWRITE_PNG_COMPRESSION, 1 }))
+		return false;
+
+	const uint8_t *pColor = image.color_.data_.data();
+	size_t colorSize = image.color_.data_.size();
+	if(colorCodec_ == COLOR_JPEG)
+	{
+		const cv::Mat color(image.color_.height_, image.color_.width_, CV_8UC3, const_cast<uint8_t *>(pColor));
+		if(!cv::imencode(".jpg", color, colorBuffer, { cv::IMWRITE_JPEG_QUALITY, 95 }))
+			return false;
+		pColor = colorBuffer.data();
+		colorSize = colorBuffer.size();
+	}
+
+	std::vector<uint8_t> header;
+	header.reserve(frameHeaderSize);
+	put<uint32_t>(header, frameTag);
+	put<uint32_t>(header, 0);	// reserved
+	put<uint64_t>(header, frame.timestamp);
+	put<uint32_t>(header, (frame.isKeyframe ? flagKeyframe : 0) | (frame.isTrackingFailed ? flagTrackingFailed : 0));
+	put<uint32_t>(header, static_cast<uint32_t>(colorCodec_));
+	put<uint32_t>(header, static_cast<uint32_t>(colorSize));
+	put<uint32_t>(header, static_cast<uint32_t>(depthBuffer.size()));
+	putMatrix(header, frame.pose);
+	putMatrix(header, frame.transform);
+	putMatrix(header, frame.information);
+
+	file_.write(reinterpret_cast<const char *>(header.data()), header.size());
+	file_.write(reinterpret_cast<const char *>(pColor), colorSize);
+	file_.write(reinterpret_cast<const char *>(depthBuffer.data()), depthBuffer.size());
+	// Readers map the file while it grows, they must only see complete records
+	file_.flush();
+	return static_cast<bool>(file_);
+}
+
+/**
+ * A read-only view of the file, unmapped when the last record using it is gone.
+ */
+struct FrameJournalReader::Mapping
+{
+	const uint8_t *data{ nullptr };
+	size_t size{ 0 };
+#ifdef _WIN32
+	void *mappingHandle{ nullptr };
+#endif
+
+	~Mapping();
+};
+
+FrameJournalReader::FrameJournalReader()
+{
+}
+
+FrameJournalReader::~FrameJournalReader()
+{
+	close();
+}
+
+bool FrameJournalReader::open(const std::string &filename)
+{
+	close();
+	filename_ = filename;
+
+	if(!map() || mapping_->size < fileHeaderSize || std::memcmp(mapping_->data, fileMagic, sizeof(fileMagic)) != 0)
+	{
+		std::cerr << "FrameJournal: " << filename << " is not a frame journal" << std::endl;
+		close();
+		return false;
+	}
+
+	const uint8_t *p = mapping_->data + sizeof(fileMagic);
+	const uint32_t version = get<uint32_t>(p);
+	width_ = get<int32_t>(p);
+	height_ = get<int32_t>(p);
+	get<uint32_t>(p);	// reserved
+	depthScale_ = get<double>(p);
+
+	scanOffset_ = fileHeaderSize;
+	hasIntrinsic_ = (version >= 2);
+	if(hasIntrinsic_)
+	{
+		if(mapping_->size < fileHeaderSize + intrinsicSize)
+		{
+			std::cerr << "FrameJournal: " << filename << " is cut off" << std::endl;
+			close();
+			return false;
+		}
+		fx_ = get<double>(p);
+		fy_ = get<double>(p);
+		cx_ = get<double>(p);
+		cy_ = get<double>(p);
+		scanOffset_ += intrinsicSize;
+	}
+	return refresh();
+}
+
+void FrameJournalReader::close()
+{
+	unmap();
+	closeFile();
+	offsets_.clear();
+	scanOffset_ = 0;
+	hasIntrinsic_ = false;
+}
+
+bool FrameJournalReader::refresh()
+{
+	if(!mapping_)
+		return false;
+	if(getFileSize() > mapping_->size)
+	{
+		unmap();
+		if(!map())
+			return false;
+	}
+
+	const size_t mappedSize = mapping_->size;
+	while(scanOffset_ + frameHeaderSize <= mappedSize)
+	{
+		const uint8_t *p = mapping_->data + scanOffset_;
+		FrameHeader header;
+		if(!readFrameHeader(p, header))
+		{
+			std::cerr << "FrameJournal: Corrupt record in " << filename_ << " at " << scanOffset_ << std::endl;
+			break;
+		}
+
+		const uint64_t recordSize = frameHeaderSize + static_cast<uint64_t>(header.colorSize) + header.depthSize;
+		if(scanOffset_ + recordSize > mappedSize)
+			break;	// Still being written or cut off
+
+		offsets_.push_back(scanOffset_);
+		scanOffset_ += recordSize;
+	}
+	return true;
+}
+
+std::shared_ptr<JournalFrame> FrameJournalReader::readFrame(size_t index, bool withImage) const
+{
+	Record record;
+	if(!getRecord(index, record))
+		return nullptr;
+	return decodeFrame(record, withImage);
+}
+
+bool FrameJournalReader::getRecord(size_t index, Record &record) const
+{
+	if(index >= offsets_.size())
+		return false;
+
+	record.mapping = mapping_;
+	record.offset = offsets_[index];
+	record.width = width_;
+	record.height = height_;
+	record.depthScale = depthScale_;
+	return true;
+}
+
+std::shared_ptr<JournalFrame> FrameJournalReader::decodeFrame(const Record &record, bool withImage)
+{
+	const int width = record.width, height = record.height;
+	const uint8_t *p = record.mapping->data + record.offset;
+	FrameHeader header;
+	readFrameHeader(p, header);
+
+	std::shared_ptr<JournalFrame> frame(new JournalFrame);
+	frame->timestamp = header.timestamp;
+	frame->isKeyframe = (header.flags & flagKeyframe) != 0;
+	frame->isTrackingFailed = (header.flags & flagTrackingFailed) != 0;
+	getMatrix(p, frame->pose);
+	getMatrix(p, frame->transform);
+	getMatrix(p, frame->information);
+	if(!withImage)
+		return frame;
+
+	const uint8_t *pColor = p;
+	const uint8_t *pDepth = p + header.colorSize;
+
+	const cv::Mat depth16 = cv::imdecode(cv::Mat(1, static_cast<int>(header.depthSize), CV_8UC1, const_cast<uint8_t *>(pDepth)), cv::IMREAD_UNCHANGED);
+	if(depth16.empty() || depth16.cols != width || depth16.rows != height || depth16.type() != CV_16UC1)
+		return nullptr;
+
+	auto image = std::make_shared<open3d::geometry::RGBDImage>();
+	image->depth_.Prepare(width, height, 1, 4);
+	const float invDepthScale = static_cast<float>(1.0 / record.depthScale);
+	for(int y = 0; y < height; y++)
+	{
+		const uint16_t *pSrc = depth16.ptr<uint16_t>(y);
+		float *pDst = reinterpret_cast<float *>(image->depth_.data_.data()) + static_cast<size_t>(y) * width;
+		for(int x = 0; x < width; x++)
+			pDst[x] = pSrc[x] * invDepthScale;
+	}
+
+	image->color_.Prepare(width, height, 3, 1);
+	const size_t rowBytes = static_cast<size_t>(width) * 3;
+	if(header.colorCodec == FrameJournalWriter::COLOR_JPEG)
+	{
+		const cv::Mat color = cv::imdecode(cv::Mat(1, static_cast<int>(header.colorSize), CV_8UC1, const_cast<uint8_t *>(pColor)), cv::IMREAD_COLOR);
+		if(color.cols != width || color.rows != height)
+			return nullptr;
+		for(int y = 0; y < height; y++)
+			std::memcpy(image->color_.data_.data() + y * rowBytes, color.ptr<uint8_t>(y), rowBytes);
+	}
+	else
+	{
+		if(header.colorSize != rowBytes * height)
+			return nullptr;
+		std::memcpy(image->color_.data_.data(), pColor, header.colorSize);
+	}
+
+	frame->image = image;
+	return frame;
+}
+
+#ifdef _WIN32
+
+uint64_t FrameJournalReader::getFileSize() const
+{
+	LARGE_INTEGER size;
+	if(!fileHandle_ || !GetFileSizeEx(fileHandle_, &size))
+		return 0;
+	return static_cast<uint64_t>(size.QuadPart);
+}
+
+bool FrameJournalReader::map()
+{
+	if(!fileHandle_)
+	{
+		// The writer may still have the file open
+		HANDLE file = CreateFileA(filename_.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if(file == INVALID_HANDLE_VALUE)
+			return false;
+		fileHandle_ = file;
+	}
+
+	const uint64_t size = getFileSize();
+	if(size == 0)
+		return false;
+
+	std::shared_ptr<Mapping> mapping = std::make_shared<Mapping>();
+	mapping->mappingHandle = CreateFileMappingA(fileHandle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(!mapping->mappingHandle)
+		return false;
+	mapping->data = static_cast<const uint8_t *>(MapViewOfFile(mapping->mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if(!mapping->data)
+		return false;
+	mapping->size = static_cast<size_t>(size);
+	mapping_ = mapping;
+	return true;
+}
+
+void FrameJournalReader::closeFile()
+{
+	if(fileHandle_)
+		CloseHandle(fileHandle_);
+	fileHandle_ = nullptr;
+}
+
+void FrameJournalReader::unmap()
+{
+	mapping_.reset();
+}
+
+FrameJournalReader::Mapping::~Mapping()
+{
+	if(data)
+		UnmapViewOfFile(data);
+	if(mappingHandle)
+		CloseHandle(mappingHandle);
+}
+
+#else
+
+uint64_t FrameJournalReader::getFileSize() const
+{
+	struct stat status;
+	if(fileDescriptor_ < 0 || fstat(fileDescriptor_, &status) != 0)
+		return 0;
+	return static_cast<uint64_t>(status.st_size);
+}
+
+bool FrameJournalReader::map()
+{
+	if(fileDescriptor_ < 0)
+	{
+		fileDescriptor_ = ::open(filename_.c_str(), O_RDONLY);
+		if(fileDescriptor_ < 0)
+			return false;
+	}
+
+	const uint64_t size = getFileSize();
+	if(size == 0)
+		return false;
+
+	void *data = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED, fileDescriptor_, 0);
+	if(data == MAP_FAILED)
+		return false;
+	std::shared_ptr<Mapping> mapping = std::make_shared<Mapping>();
+	mapping->data = static_cast<const uint8_t *>(data);
+	mapping->size = static_cast<size_t>(size);
+	mapping_ = mapping;
+	return true;
+}
+
+void FrameJournalReader::closeFile()
+{
+	if(fileDescriptor_ >= 0)
+		::close(fileDescriptor_);
+	fileDescriptor_ = -1;
+}
+
+void FrameJournalReader::unmap()
+{
+	mapping_.reset();
+}
+
+FrameJournalReader::Mapping::~Mapping()
+{
+	if(data)
+		munmap(const_cast<uint8_t *>(data), size);
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef FRAMEJOURNAL_H
+#define FRAMEJOURNAL_H
+
+#include "BoundedQueue.h"
+
+#include "open3d/Open3D.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * One frame of a journal: the images, when they were taken and the online
+ * tracking result (the Stitcher's posvec_, transvec_ and infovec_ entries).
+ */
+struct JournalFrame
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	std::shared_ptr<const open3d::geometry::RGBDImage> image;	//!< Float depth in metres, RGB8 color
+	uint64_t timestamp{ 0 };	//!< Microseconds, only differences are meaningful
+	bool isKeyframe{ false };
+	bool isTrackingFailed{ false };	//!< The odometry failed, the pose is the previous frame's
+	Eigen::Matrix4d pose{ Eigen::Matrix4d::Identity() };
+	Eigen::Matrix4d transform{ Eigen::Matrix4d::Identity() };
+	Eigen::Matrix6d information{ Eigen::Matrix6d::Identity() };
+};
+
+/**
+ * Appends frames to a journal file.
+ *
+ * The file starts with a header (resolution, depth scale and, since version 2,
+ * the camera intrinsics), followed by one
+ * record per frame. Depth is stored as 16 bit PNG (row prediction plus
+ * deflate, lossless), color raw or as JPEG. Records are only ever appended
+ * and flushed one by one, so a journal that was cut off (e.g. by a crash) can
+ * still be read up to the last complete frame.
+ *
+ * Encoding and writing run on a thread of their own.
+ */
+class FrameJournalWriter
+{
+public:
+	enum ColorCodec
+	{
+		COLOR_RAW,
+		COLOR_JPEG
+	};
+
+	FrameJournalWriter();
+	~FrameJournalWriter();
+
+	/**
+	 * Creates the file, an existing one is overwritten.
+	 */
+	bool open(const std::string &filename, int width, int height, double depthScale,
+		const open3d::camera::PinholeCameraIntrinsic &intrinsic, ColorCodec colorCodec = COLOR_JPEG);
+	bool isOpen() const { return writerThread_.joinable(); }
+
+	/**
+	 * Queues a frame for writing, never blocks. The queue only shares the
+	 * frames, which the caller keeps until getWrittenFrames() includes them.
+	 */
+	bool append(const std::shared_ptr<const JournalFrame> &frame);
+
+	/**
+	 * Number of frames completely written to the file so far, in order of append().
+	 */
+	size_t getWrittenFrames() const { return writtenFrames_; }
+	/**
+	 * True once a frame could not be written; no later frame is written either.
+	 */
+	bool hasFailed() const { return hasFailed_; }
+
+	/**
+	 * Writes the queued frames and closes the file.
+	 */
+	void close();
+
+private:
+	void writerEntry();
+	bool writeFrame(const JournalFrame &frame);
+
+	std::ofstream file_;
+	std::string filename_;
+	double depthScale_{ 1000.0 };
+	ColorCodec colorCodec_{ COLOR_JPEG };
+
+	std::unique_ptr<BoundedQueue<std::shared_ptr<const JournalFrame> > > queue_;
+	std::thread writerThread_;
+	std::atomic<size_t> writtenFrames_{ 0 };
+	std::atomic<bool> hasFailed_{ false };
+};
+
+/**
+ * Reads a journal file through a read-only memory mapping.
+ *
+ * Only the frames that are accessed are paged in and decoded, so a journal
+ * of any length can be processed with bounded memory. The file may still be
+ * growing: refresh() picks up frames appended since open().
+ *
+ * Not thread-safe, except for decodeFrame(): a record located by getRecord()
+ * keeps its mapping alive, so it can be decoded without holding the lock
+ * that guards the reader.
+ */
+class FrameJournalReader
+{
+public:
+	struct Mapping;
+
+	/**
+	 * Location of a frame in a mapping of the journal.
+	 */
+	struct Record
+	{
+		std::shared_ptr<const Mapping> mapping;
+		uint64_t offset{ 0 };
+		int width{ 0 }, height{ 0 };
+		double depthScale{ 1000.0 };
+	};
+
+	FrameJournalReader();
+	~FrameJournalReader();
+
+	bool open(const std::string &filename);
+	void close();
+	bool isOpen() const { return mapping_ != nullptr; }
+
+	/**
+	 * Maps the current end of the file and indexes the frames added since the last call.
+	 */
+	bool refresh();
+
+	size_t size() const { return offsets_.size(); }
+	int getWidth() const { return width_; }
+	int getHeight() const { return height_; }
+	double getDepthScale() const { return depthScale_; }
+	/**
+	 * Journals of version 1 have no intrinsics.
+	 */
+	bool hasIntrinsic() const { return hasIntrinsic_; }
+	open3d::camera::PinholeCameraIntrinsic getIntrinsic() const
+	{
+		return open3d::camera::PinholeCameraIntrinsic(width_, height_, fx_, fy_, cx_, cy_);
+	}
+
+	/**
+	 * Returns nullptr if the frame could not be decoded. With withImage false,
+	 * only the timestamp, flags and poses are read.
+	 */
+	std::shared_ptr<JournalFrame> readFrame(size_t index, bool withImage = true) const;
+
+	/**
+	 * Returns false if there is no such frame.
+	 */
+	bool getRecord(size_t index, Record &record) const;
+	static std::shared_ptr<JournalFrame> decodeFrame(const Record &record, bool withImage = true);
+
+private:
+	bool map();
+	void unmap();
+	void closeFile();
+	uint64_t getFileSize() const;
+
+	std::string filename_;
+	int width_{ 0 }, height_{ 0 };
+	double depthScale_{ 1000.0 };
+	bool hasIntrinsic_{ false };
+	double fx_{ 0 }, fy_{ 0 }, cx_{ 0 }, cy_{ 0 };
+
+	// Replaced when the file has grown, records still hold on to the old one
+	std::shared_ptr<const Mapping> mapping_;
+#ifdef _WIN32
+	void *fileHandle_{ nullptr };
+#else
+	int fileDescriptor_{ -1 };
+#endif
+
+	std::vector<uint64_t> offsets_;
+	uint64_t scanOffset_{ 0 };
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Lock-free single-producer/single-consumer ring of pre-allocated slots.
+ *
+ * The producer (OpenNI callback thread) calls beginWrite(), fills the slot
+ * in place and publishes it with commitWrite(). The consumer (converter thread)
+ * reads the oldest slot in place via front() and hands it back with pop().
+ * Slots are never reallocated, so buffers inside T are reused from frame to frame.
+ *
+ * If the ring is full, beginWrite() returns nullptr and the producer is
+ * expected to drop the frame; this never blocks the driver.
+ */
+template <typename T>
+class FrameRing
+{
+public:
+	explicit FrameRing(size_t capacity)
+		: slots_(capacity + 1), head_(0), tail_(0)
+	{
+	}
+
+	/**
+	 * Returns the next free slot, or nullptr if the ring is full.
+	 *
+	 * Producer only.
+	 */
+	T *beginWrite()
+	{
+		const size_t tail = tail_.load(std::memory_order_relaxed);
+		const size_t next = increment(tail);
+		if(next == head_.load(std::memory_order_acquire))
+			return nullptr;
+		return &slots_[tail];
+	}
+
+	/**
+	 * Publishes the slot returned by beginWrite() to the consumer.
+	 *
+	 * Producer only.
+	 */
+	void commitWrite()
+	{
+		const size_t tail = tail_.load(std::memory_order_relaxed);
+		tail_.store(increment(tail), std::memory_order_release);
+	}
+
+	/**
+	 * Returns the oldest published slot, or nullptr if the ring is empty.
+	 *
+	 * Consumer only. The slot stays valid until pop() is called.
+	 */
+	T *front()
+	{
+		const size_t head = head_.load(std::memory_order_relaxed);
+		if(head == tail_.load(std::memory_order_acquire))
+			return nullptr;
+		return &slots_[head];
+	}
+
+	/**
+	 * Releases the slot returned by front() back to the producer.
+	 *
+	 * Consumer only.
+	 */
+	void pop()
+	{
+		const size_t head = head_.load(std::memory_order_relaxed);
+		head_.store(increment(head), std::memory_order_release);
+	}
+
+	bool empty() const
+	{
+		return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const { return slots_.size() - 1; }
+
+private:
+	size_t increment(size_t index) const
+	{
+		index++;
+		return (index == slots_.size()) ? 0 : index;
+	}
+
+	std::vector<T> slots_;
+
+	// Head is written by the consumer, tail by the producer; keep them on separate cache lines
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) std::atomic<size_t> tail_;
+};
+
+#endif
@@ -0,0 +1,348 @@
+#include "FrameStore.h"
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+FrameStore::FrameStore()
+	: lastKeyframePose_(Eigen::Matrix4d::Identity())
+{
+}
+
+FrameStore::~FrameStore()
+{
+	clear();
+}
+
+bool FrameStore::add(const std::shared_ptr<const open3d::geometry::RGBDImage> &image, uint64_t timestamp,
+	const Eigen::Matrix4d &pose, const Eigen::Matrix4d &transform, const Eigen::Matrix6d &information,
+	bool isTrackingFailed)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if(isReadOnly_)
+		return false;
+
+	if(!journalWriter_.isOpen() && !isJournalFailed_
+		&& !journalWriter_.open(journalFilename_, image->depth_.width_, image->depth_.height_, depthScale_, intrinsic_))
+	{
+		// Reported once, the following frames are only kept in memory
+		std::cerr << "FrameStore: No frame journal, frames are not spilled to disk" << std::endl;
+		isJournalFailed_ = true;
+	}
+
+	std::shared_ptr<JournalFrame> frame(new JournalFrame);
+	frame->image = image;
+	frame->timestamp = timestamp;
+	frame->isKeyframe = selectKeyframe(*image, pose, isTrackingFailed);
+	frame->isTrackingFailed = isTrackingFailed;
+	frame->pose = pose;
+	frame->transform = transform;
+	frame->information = information;
+
+	Entry entry;
+	entry.frame = frame;
+	entry.isKeyframe = frame->isKeyframe;
+	entry.isTrackingFailed = isTrackingFailed;
+	if(entry.isKeyframe)
+		entry.descriptor = computeDescriptor(image->color_);
+	// The writer queue is unbounded, so this does not wait for the disk
+	if(journalWriter_.append(frame))
+		entry.journalIndex = journaledFrames_++;
+	entries_.push_back(entry);
+	memoryUsage_ += getImageBytes(*image);
+
+	enforceMemoryLimit();
+
+	return frame->isKeyframe;
+}
+
+bool FrameStore::load(const std::string &filename)
+{
+	clear();
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	journalFilename_ = filename;
+	if(!openReader())
+		return false;
+
+	depthScale_ = journalReader_.getDepthScale();
+	if(journalReader_.hasIntrinsic())
+		intrinsic_ = journalReader_.getIntrinsic();
+	isReadOnly_ = true;
+	for(size_t i = 0; i < journalReader_.size(); i++)
+	{
+		auto frame = journalReader_.readFrame(i, false);
+		Entry entry;
+		entry.journalIndex = i;
+		entry.isKeyframe = frame->isKeyframe;
+		entry.isTrackingFailed = frame->isTrackingFailed;
+		entries_.push_back(entry);
+	}
+	spilledFrames_ = entries_.size();
+	return true;
+}
+
+std::shared_ptr<const open3d::geometry::RGBDImage> FrameStore::get(size_t index)
+{
+	std::shared_ptr<const JournalFrame> frame = readFrame(index, true);
+	return frame ? frame->image : nullptr;
+}
+
+std::shared_ptr<const JournalFrame> FrameStore::getFrameInfo(size_t index)
+{
+	return readFrame(index, false);
+}
+
+/**
+ * Only locates the frame under the lock. The record keeps its mapping of the
+ * journal alive, so the decoding runs in parallel with other readers and add().
+ */
+std::shared_ptr<const JournalFrame> FrameStore::readFrame(size_t index, bool withImage)
+{
+	FrameJournalReader::Record record;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		const Entry &entry = entries_[index];
+		if(entry.frame)
+			return entry.frame;
+
+		if(!openReader())
+			return nullptr;
+		if(entry.journalIndex >= journalReader_.size())
+			journalReader_.refresh();
+		if(!journalReader_.getRecord(entry.journalIndex, record))
+			return nullptr;
+	}
+
+	auto frame = FrameJournalReader::decodeFrame(record, withImage);
+	if(!frame)
+		std::cerr << "FrameStore: Could not read frame " << index << " from " << journalFilename_ << std::endl;
+	return frame;
+}
+
+size_t FrameStore::size()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	return entries_.size();
+}
+
+bool FrameStore::isKeyframe(size_t index)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	return entries_[index].isKeyframe;
+}
+
+bool FrameStore::isTrackingFailed(size_t index)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	return entries_[index].isTrackingFailed;
+}
+
+std::vector<size_t> FrameStore::getKeyframes()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	std::vector<size_t> keyframes;
+	for(size_t i = 0; i < entries_.size(); i++)
+	{
+		if(entries_[i].isKeyframe)
+			keyframes.push_back(i);
+	}
+	return keyframes;
+}
+
+std::vector<float> FrameStore::getDescriptor(size_t index)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if(!entries_[index].descriptor.empty())
+			return entries_[index].descriptor;
+	}
+
+	auto image = get(index);
+	if(!image)
+		return std::vector<float>();
+	std::vector<float> descriptor = computeDescriptor(image->color_);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	if(index < entries_.size())
+		entries_[index].descriptor = descriptor;
+	return descriptor;
+}
+
+size_t FrameStore::getMemoryUsage()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	return memoryUsage_;
+}
+
+size_t FrameStore::getSpilledFrames()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	return spilledFrames_;
+}
+
+bool FrameStore::isJournalFailed()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	return isJournalFailed_ || journalWriter_.hasFailed();
+}
+
+void FrameStore::clear()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	// The reader goes first, a mapped file cannot be overwritten on every platform
+	journalReader_.close();
+	journalWriter_.close();
+
+	entries_.clear();
+	memoryUsage_ = 0;
+	spilledFrames_ = 0;
+	journaledFrames_ = 0;
+	isJournalFailed_ = false;
+	nonKeyframeSpillIndex_ = 0;
+	keyframeSpillIndex_ = 0;
+	isReadOnly_ = false;
+	lastKeyframePose_ = Eigen::Matrix4d::Identity();
+	averageSharpness_ = 0;
+}
+
+/**
+ * Decides whether the new frame becomes a keyframe, the first frame always does
+ * and frames whose tracking failed never do.
+ */
+bool FrameStore::selectKeyframe(const open3d::geometry::RGBDImage &image, const Eigen::Matrix4d &pose, bool isTrackingFailed)
+{
+	const double sharpness = computeSharpness(image.color_);
+	const bool isFirst = entries_.empty();
+	averageSharpness_ = isFirst ? sharpness : (0.9 * averageSharpness_ + 0.1 * sharpness);
+
+	bool isKeyframe = isFirst;
+	if(isTrackingFailed)
+		isKeyframe = false;
+	else if(!isFirst)
+	{
+		const Eigen::Matrix4d motion = pose * lastKeyframePose_.inverse();
+		const double translation = motion.block<3, 1>(0, 3).norm();
+		const double cosAngle = std::min(1.0, std::max(-1.0, 0.5 * (motion.block<3, 3>(0, 0).trace() - 1.0)));
+		const double rotation = std::acos(cosAngle);
+
+		const bool hasMoved = (translation > keyframeTranslation_ || rotation > keyframeRotation_);
+		// Blurry frames make bad keyframes, wait for a sharper one unless it gets too far
+		const bool hasMovedFar = (translation > 2.0 * keyframeTranslation_ || rotation > 2.0 * keyframeRotation_);
+		const bool isSharp = (sharpness >= blurRatio_ * averageSharpness_);
+		isKeyframe = hasMovedFar || (hasMoved && isSharp);
+	}
+
+	if(isKeyframe)
+		lastKeyframePose_ = pose;
+	return isKeyframe;
+}
+
+/**
+ * Drops the oldest frames from memory until the memory limit is met, non-keyframes first.
+ *
+ * Only frames that are already in the journal can be dropped, so the memory
+ * use may exceed the limit by the frames queued in the journal writer.
+ */
+void FrameStore::enforceMemoryLimit()
+{
+	const size_t numWritten = journalWriter_.getWrittenFrames();
+
+	while(memoryUsage_ > memoryLimit_ && nonKeyframeSpillIndex_ < entries_.size())
+	{
+		Entry &entry = entries_[nonKeyframeSpillIndex_];
+		const bool isJournaled = (entry.journalIndex != notJournaled);
+		if(isJournaled && entry.journalIndex >= numWritten)
+			break;	// Still queued in the writer
+		if(!entry.isKeyframe && entry.frame && isJournaled)
+			spill(entry);
+		nonKeyframeSpillIndex_++;
+	}
+	while(memoryUsage_ > memoryLimit_ && keyframeSpillIndex_ < entries_.size())
+	{
+		Entry &entry = entries_[keyframeSpillIndex_];
+		const bool isJournaled = (entry.journalIndex != notJournaled);
+		if(isJournaled && entry.journalIndex >= numWritten)
+			break;
+		if(entry.frame && isJournaled)
+			spill(entry);
+		keyframeSpillIndex_++;
+	}
+}
+
+void FrameStore::spill(Entry &entry)
+{
+	memoryUsage_ -= getImageBytes(*entry.frame->image);
+	entry.frame.reset();
+	spilledFrames_++;
+}
+
+bool FrameStore::openReader()
+{
+	if(journalReader_.isOpen())
+		return true;
+	return journalReader_.open(journalFilename_);
+}
+
+size_t FrameStore::getImageBytes(const open3d::geometry::RGBDImage &image)
+{
+	return image.color_.data_.size() + image.depth_.data_.size();
+}
+
+/**
+ * Variance of the Laplacian of the gray image, low for blurry images.
+ */
+double FrameStore::computeSharpness(const open3d::geometry::Image &color)
+{
+	if(color.num_of_channels_ != 3 || color.bytes_per_channel_ != 1)
+		return 0;
+
+	const cv::Mat rgb(color.height_, color.width_, CV_8UC3, const_cast<uint8_t *>(color.data_.data()));
+	cv::Mat gray, small, laplacian;
+	cv::cvtColor(rgb, gray, cv::COLOR_RGB2GRAY);
+	// Half resolution is enough to tell blurry from sharp and four times faster
+	cv::pyrDown(gray, small);
+	cv::Laplacian(small, laplacian, CV_16S);
+
+	cv::Scalar mean, stddev;
+	cv::meanStdDev(laplacian, mean, stddev);
+	return stddev[0] * stddev[0];
+}
+
+std::vector<float> FrameStore::computeDescriptor(const open3d::geometry::Image &color)
+{
+	std::vector<float> descriptor;
+	if(color.num_of_channels_ != 3 || color.bytes_per_channel_ != 1)
+		return descriptor;
+
+	const cv::Mat rgb(color.height_, color.width_, CV_8UC3, const_cast<uint8_t *>(color.data_.data()));
+	cv::Mat gray, thumbnail;
+	cv::cvtColor(rgb, gray, cv::COLOR_RGB2GRAY);
+	cv::resize(gray, thumbnail, cv::Size(16, 12), 0, 0, cv::INTER_AREA);
+
+	descriptor.assign(thumbnail.begin<uint8_t>(), thumbnail.end<uint8_t>());
+	double mean = 0;
+	for(float value : descriptor)
+		mean += value;
+	mean /= static_cast<double>(descriptor.size());
+
+	// Zero mean and unit length make the comparison independent of exposure
+	double norm2 = 0;
+	for(float &value : descriptor)
+	{
+		value -= static_cast<float>(mean);
+		norm2 += static_cast<double>(value) * value;
+	}
+	const float scale = (norm2 > 0) ? static_cast<float>(1.0 / std::sqrt(norm2)) : 0.0f;
+	for(float &value : descriptor)
+		value *= scale;
+	return descriptor;
+}
@@ -0,0 +1,178 @@
+#ifndef FRAMESTORE_H
+#define FRAMESTORE_H
+
+#include "FrameJournal.h"
+
+#include "open3d/Open3D.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Holds the RGBD frames of a scan for the optimization in Stitcher::saveVolume().
+ *
+ * Every added frame is recorded in a frame journal together with its poses.
+ * Up to the memory limit, frames are also kept in RAM; beyond that, the
+ * oldest frames are dropped from RAM (non-keyframes first) and read back
+ * from the journal on demand.
+ *
+ * The journal is written on a thread of its own and add() never waits for
+ * it; a frame is only dropped from RAM once it has been written. If the
+ * journal cannot be written, the frames are kept in RAM regardless of the
+ * limit and isJournalFailed() is set.
+ *
+ * Keyframes are selected by the camera motion since the last keyframe; a
+ * candidate that is blurrier than the recent frames is postponed to one of
+ * the next frames unless the motion gets too large.
+ */
+class FrameStore
+{
+public:
+	FrameStore();
+	~FrameStore();
+
+	/**
+	 * Maximum bytes of image data held in memory, default 2 GB.
+	 */
+	void setMemoryLimit(size_t bytes) { memoryLimit_ = bytes; }
+	size_t getMemoryLimit() const { return memoryLimit_; }
+	/**
+	 * The journal is created on the first add() after construction or clear(),
+	 * an existing file is overwritten. It is kept after clear().
+	 */
+	void setJournalFile(const std::string &filename) { journalFilename_ = filename; }
+	/**
+	 * Used to store the float depth losslessly as 16 bit values.
+	 */
+	void setDepthScale(double depthScale) { depthScale_ = depthScale; }
+	/**
+	 * Camera intrinsics recorded in the journal. After load(), those of the
+	 * journal, unless it is too old to have them.
+	 */
+	void setIntrinsic(const open3d::camera::PinholeCameraIntrinsic &intrinsic) { intrinsic_ = intrinsic; }
+	const open3d::camera::PinholeCameraIntrinsic &getIntrinsic() const { return intrinsic_; }
+
+	/**
+	 * A new keyframe is selected once the camera moved by more than translation
+	 * (in metres) or rotated by more than rotation (in radians), unless its
+	 * sharpness is below blurRatio times the average of the recent frames.
+	 */
+	void setKeyframeThresholds(double translation, double rotation, double blurRatio)
+	{
+		keyframeTranslation_ = translation;
+		keyframeRotation_ = rotation;
+		blurRatio_ = blurRatio;
+	}
+
+	/**
+	 * Adds a frame with its pose (extrinsic), the motion relative to the previous
+	 * frame and the information matrix of that motion. Returns true if it became
+	 * a keyframe.
+	 *
+	 * A frame whose odometry failed is recorded with isTrackingFailed; its pose is
+	 * just the previous one, so it never becomes a keyframe.
+	 *
+	 * The image is shared, not copied, and must not be modified afterwards.
+	 *
+	 * Frames have to be added from a single thread, which must not call clear()
+	 * or load() at the same time. The other methods may be called concurrently.
+	 */
+	bool add(const std::shared_ptr<const open3d::geometry::RGBDImage> &image, uint64_t timestamp,
+		const Eigen::Matrix4d &pose, const Eigen::Matrix4d &transform, const Eigen::Matrix6d &information,
+		bool isTrackingFailed = false);
+
+	/**
+	 * Replaces the content by the frames of an existing journal, e.g. to rerun
+	 * the optimization offline. The store is read-only afterwards, until clear().
+	 */
+	bool load(const std::string &filename);
+	bool isReadOnly() const { return isReadOnly_; }
+
+	/**
+	 * Returns the frame, reading it from the journal if it is not in memory.
+	 */
+	std::shared_ptr<const open3d::geometry::RGBDImage> get(size_t index);
+
+	/**
+	 * Timestamp, keyframe flag and poses of a frame, without the image.
+	 */
+	std::shared_ptr<const JournalFrame> getFrameInfo(size_t index);
+
+	size_t size();
+	bool isKeyframe(size_t index);
+	bool isTrackingFailed(size_t index);
+	std::vector<size_t> getKeyframes();
+
+	/**
+	 * Global appearance descriptor of a keyframe for LoopClosureIndex: a 16x12
+	 * grey thumbnail, zero mean and unit length. Empty if the frame has no
+	 * 8 bit RGB color image.
+	 *
+	 * Computed when the keyframe is added, or on the first request for a loaded journal.
+	 */
+	std::vector<float> getDescriptor(size_t index);
+
+	size_t getMemoryUsage();
+	size_t getSpilledFrames();
+	/**
+	 * True if the journal could not be created or written. The scan is incomplete
+	 * on disk then and the memory limit no longer holds.
+	 */
+	bool isJournalFailed();
+
+	/**
+	 * Removes all frames and closes the journal.
+	 */
+	void clear();
+
+private:
+	static const size_t notJournaled = static_cast<size_t>(-1);
+
+	struct Entry
+	{
+		std::shared_ptr<const JournalFrame> frame;	// nullptr if only in the journal
+		size_t journalIndex{ notJournaled };	// Record in the journal, if it was written
+		bool isKeyframe{ false };
+		bool isTrackingFailed{ false };
+		std::vector<float> descriptor;	// Keyframes only, kept when the frame is spilled
+	};
+
+	std::shared_ptr<const JournalFrame> readFrame(size_t index, bool withImage);
+	bool selectKeyframe(const open3d::geometry::RGBDImage &image, const Eigen::Matrix4d &pose, bool isTrackingFailed);
+	void enforceMemoryLimit();
+	void spill(Entry &entry);
+	bool openReader();
+
+	static size_t getImageBytes(const open3d::geometry::RGBDImage &image);
+	static double computeSharpness(const open3d::geometry::Image &color);
+	static std::vector<float> computeDescriptor(const open3d::geometry::Image &color);
+
+	std::mutex mutex_;
+
+	size_t memoryLimit_{ static_cast<size_t>(2048) * 1024 * 1024 };
+	std::string journalFilename_{ "scan_journal.bin" };
+	double depthScale_{ 1000.0 };
+	open3d::camera::PinholeCameraIntrinsic intrinsic_;
+	double keyframeTranslation_{ 0.05 }, keyframeRotation_{ 0.1 }, blurRatio_{ 0.8 };
+
+	std::vector<Entry> entries_;
+	size_t memoryUsage_{ 0 };
+	size_t spilledFrames_{ 0 };
+	size_t journaledFrames_{ 0 };
+	bool isJournalFailed_{ false };
+	// Entries before these indices are known to be spilled (or keyframes, for the first one)
+	size_t nonKeyframeSpillIndex_{ 0 }, keyframeSpillIndex_{ 0 };
+	bool isReadOnly_{ false };
+
+	Eigen::Matrix4d lastKeyframePose_;
+	double averageSharpness_{ 0 };
+
+	FrameJournalWriter journalWriter_;
+	FrameJournalReader journalReader_;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "FrameSynchronizer.h"
+
+FrameSynchronizer::FrameSynchronizer(size_t queueSize, uint64_t tolerance)
+	: queueSize_(queueSize), tolerance_(tolerance)
+{
+}
+
+void FrameSynchronizer::addDepthFrame(const FrameHandle &frame)
+{
+	addFrame(depthQueue_, frame, droppedDepthFrames_);
+}
+
+void FrameSynchronizer::addColorFrame(const FrameHandle &frame)
+{
+	addFrame(colorQueue_, frame, droppedColorFrames_);
+}
+
+void FrameSynchronizer::addFrame(std::deque<FrameHandle> &queue, const FrameHandle &frame, int &droppedFrames)
+{
+	// A timestamp going backwards means the stream was restarted, the queued frames are useless
+	if(!queue.empty() && frame.getTimestamp() < queue.back().getTimestamp())
+	{
+		droppedFrames += static_cast<int>(queue.size());
+		queue.clear();
+	}
+
+	queue.push_back(frame);
+	while(queue.size() > queueSize_)
+	{
+		queue.pop_front();
+		droppedFrames++;
+	}
+}
+
+uint64_t FrameSynchronizer::timeDifference(const FrameHandle &a, const FrameHandle &b)
+{
+	return (a.getTimestamp() > b.getTimestamp())
+		? a.getTimestamp() - b.getTimestamp()
+		: b.getTimestamp() - a.getTimestamp();
+}
+
+bool FrameSynchronizer::getPair(FrameHandle &depthFrame, FrameHandle &colorFrame)
+{
+	while(!depthQueue_.empty() && !colorQueue_.empty())
+	{
+		const FrameHandle &depth = depthQueue_.front();
+		const FrameHandle &color = colorQueue_.front();
+
+		// Timestamps are increasing: a frame that is too old for the other
+		// stream's oldest frame will not match any later frame either
+		if(color.getTimestamp() + tolerance_ < depth.getTimestamp())
+		{
+			colorQueue_.pop_front();
+			droppedColorFrames_++;
+			continue;
+		}
+		if(depth.getTimestamp() + tolerance_ < color.getTimestamp())
+		{
+			depthQueue_.pop_front();
+			droppedDepthFrames_++;
+			continue;
+		}
+
+		// Within tolerance, but the next frame of either stream might be closer
+		const uint64_t diff = timeDifference(depth, color);
+		if(colorQueue_.size() > 1 && timeDifference(depth, colorQueue_[1]) < diff)
+		{
+			colorQueue_.pop_front();
+			droppedColorFrames_++;
+			continue;
+		}
+		if(depthQueue_.size() > 1 && timeDifference(depthQueue_[1], color) < diff)
+		{
+			depthQueue_.pop_front();
+			droppedDepthFrames_++;
+			continue;
+		}
+
+		depthFrame = depth;
+		colorFrame = color;
+		depthQueue_.pop_front();
+		colorQueue_.pop_front();
+		numberOfPairs_++;
+		return true;
+	}
+
+	return false;
+}
+
+void FrameSynchronizer::clear()
+{
+	depthQueue_.clear();
+	colorQueue_.clear();
+}
@@ -0,0 +1,56 @@
+#ifndef FRAMESYNCHRONIZER_H
+#define FRAMESYNCHRONIZER_H
+
+#include "FrameHandle.h"
+
+#include <deque>
+#include <cstdint>
+
+/**
+ * Pairs depth and color frames by their timestamps.
+ *
+ * Each stream has a small bounded queue. Two frames are paired if their
+ * timestamps differ by at most the tolerance and no other queued frame
+ * is closer. Frames that can no longer be paired are dropped and counted.
+ *
+ * Not thread-safe, meant to be used by the Converter thread only.
+ */
+class FrameSynchronizer
+{
+public:
+	/**
+	 * @param queueSize Maximum number of frames held per stream.
+	 * @param tolerance Maximum timestamp difference in microseconds.
+	 */
+	FrameSynchronizer(size_t queueSize = 4, uint64_t tolerance = 16000);
+
+	void setQueueSize(size_t queueSize) { queueSize_ = queueSize; }
+	void setTolerance(uint64_t tolerance) { tolerance_ = tolerance; }
+
+	void addDepthFrame(const FrameHandle &frame);
+	void addColorFrame(const FrameHandle &frame);
+
+	/**
+	 * Returns the oldest matching pair, if there is one.
+	 */
+	bool getPair(FrameHandle &depthFrame, FrameHandle &colorFrame);
+
+	void clear();
+
+	int getNumberOfPairs() const { return numberOfPairs_; }
+	int getDroppedDepthFrames() const { return droppedDepthFrames_; }
+	int getDroppedColorFrames() const { return droppedColorFrames_; }
+
+private:
+	void addFrame(std::deque<FrameHandle> &queue, const FrameHandle &frame, int &droppedFrames);
+	static uint64_t timeDifference(const FrameHandle &a, const FrameHandle &b);
+
+	std::deque<FrameHandle> depthQueue_, colorQueue_;
+	size_t queueSize_;
+	uint64_t tolerance_;
+
+	int numberOfPairs_{ 0 };
+	int droppedDepthFrames_{ 0 }, droppedColorFrames_{ 0 };
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "KeyframeGraph.h"
+#include "RGBDOdometry.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <map>
+#include <tuple>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <open3d/pipelines/registration/GlobalOptimization.h>
+
+// Each keyframe is registered with this many previous keyframes
+static const size_t maxKeyFrameDistance = 3;
+
+KeyframeGraph::KeyframeGraph(FrameStore &frameStore)
+	: frameStore_(frameStore),
+	intrinsic_(open3d::camera::PinholeCameraIntrinsicParameters::PrimeSenseDefault),
+	option_({ 20,10,5 }, 0.1)
+{
+}
+
+void KeyframeGraph::addKeyframe(size_t frameIndex, const Eigen::Matrix4d &pose)
+{
+	std::unique_lock<std::mutex> lock(pendingMutex_);
+	pendingFrameIndices_.push_back(frameIndex);
+	pendingPoses_.push_back(pose);
+}
+
+size_t KeyframeGraph::getPendingKeyframes()
+{
+	std::unique_lock<std::mutex> lock(pendingMutex_);
+	return pendingFrameIndices_.size();
+}
+
+void KeyframeGraph::update()
+{
+	TRACE_SCOPE("KeyframeGraph::update");
+
+	std::vector<size_t> frameIndices;
+	std::vector<Eigen::Matrix4d> poses;
+	{
+		std::unique_lock<std::mutex> lock(pendingMutex_);
+		frameIndices.swap(pendingFrameIndices_);
+		poses.swap(pendingPoses_);
+	}
+	if (frameIndices.empty())
+		return;
+
+	// New nodes start from their tracked poses, moved along with the last optimized keyframe
+	const size_t first = frameIndices_.size();
+	Eigen::Matrix4d correction = Eigen::Matrix4d::Identity();
+	if (first > 0)
+		correction = graph_.nodes_.back().pose_ * trackedPoses_.back();
+	for (size_t k = 0; k < frameIndices.size(); k++)
+	{
+		frameIndices_.push_back(frameIndices[k]);
+		trackedPoses_.push_back(poses[k]);
+		graph_.nodes_.push_back(open3d::pipelines::registration::PoseGraphNode(correction * poses[k].inverse()));
+		index_.add(poses[k], frameStore_.getDescriptor(frameIndices[k]));
+	}
+
+	std::vector<std::pair<size_t, size_t> > pairs;
+	for (size_t b = std::max<size_t>(first, 1); b < frameIndices_.size(); b++)
+	{
+		for (size_t a = (b > maxKeyFrameDistance) ? b - maxKeyFrameDistance : 0; a < b; a++)
+			pairs.push_back(std::make_pair(a, b));
+	}
+	size_t revisits = 0;
+	{
+		LatencyRecorder::Scope scope(latencyRecorder_.get(), "loop_closure_search");
+		const std::vector<std::pair<size_t, size_t> > candidates = index_.findCandidates(maxKeyFrameDistance + 1, first);
+		revisits = candidates.size();
+		pairs.insert(pairs.end(), candidates.begin(), candidates.end());
+		std::sort(pairs.begin(), pairs.end());
+	}
+
+	registerPairs(pairs);
+
+	if (!graph_.edges_.empty())
+	{
+		LatencyRecorder::Scope scope(latencyRecorder_.get(), "pose_graph");
+		open3d::pipelines::registration::GlobalOptimization(graph_);
+	}
+
+	std::cout << "Keyframe graph: " << frameIndices.size() << " keyframes added, " << frameIndices_.size()
+		<< " in total, " << revisits << " revisits proposed, " << graph_.edges_.size() << " edges" << std::endl;
+}
+
+/**
+ * Adds an edge for each pair of keyframes, given as positions in frameIndices_.
+ *
+ * Consecutive keyframes are always connected, by the tracked motion if the
+ * registration fails; other pairs only if the registration succeeds, and as
+ * uncertain edges the optimization may prune.
+ *
+ * The pairs are processed in batches: the odometry state of the keyframes
+ * of a batch is built, then all registrations of the batch run in parallel.
+ * The edges are added in the order of the pairs, so the result does not
+ * depend on the number of threads.
+ */
+void KeyframeGraph::registerPairs(const std::vector<std::pair<size_t, size_t> > &pairs)
+{
+	// Bounds the number of odometry frames held at the same time
+	const size_t batchSize = 64;
+
+	struct Registration
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		size_t source, target;
+		bool isSuccess{ false };
+		Eigen::Matrix4d transform;
+		Eigen::Matrix6d information;
+	};
+	std::vector<Registration, Eigen::aligned_allocator<Registration> > registrations;
+
+	// Each thread needs its own odometry, it has scratch buffers
+#ifdef _OPENMP
+	std::vector<RGBDOdometry> odometries(omp_get_max_threads());
+#else
+	std::vector<RGBDOdometry> odometries(1);
+#endif
+
+	LatencyRecorder *recorder = latencyRecorder_.get();
+	std::map<size_t, std::shared_ptr<const OdometryFrame> > keyframes;
+	for (size_t first = 0; first < pairs.size(); first += batchSize)
+	{
+		const size_t last = std::min(first + batchSize, pairs.size());
+
+		// Keep the odometry state still needed, build the one that is missing
+		std::map<size_t, std::shared_ptr<const OdometryFrame> > batchKeyframes;
+		auto keep = [&](size_t a)
+		{
+			auto it = keyframes.find(a);
+			batchKeyframes[a] = (it != keyframes.end()) ? it->second : nullptr;
+		};
+		for (size_t p = first; p < last; p++)
+		{
+			keep(pairs[p].first);
+			keep(pairs[p].second);
+		}
+		keyframes.swap(batchKeyframes);
+		batchKeyframes.clear();
+
+		std::vector<size_t> missing;
+		for (const auto &keyframe : keyframes)
+		{
+			if (!keyframe.second)
+				missing.push_back(keyframe.first);
+		}
+		std::vector<std::shared_ptr<const OdometryFrame> > built(missing.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (int k = 0; k < static_cast<int>(missing.size()); k++)
+		{
+			auto image = frameStore_.get(frameIndices_[missing[k]]);
+			if (image)
+				built[k].reset(new OdometryFrame(*image, intrinsic_, option_));
+		}
+		for (size_t k = 0; k < missing.size(); k++)
+			keyframes[missing[k]] = built[k];
+
+		registrations.clear();
+		for (size_t p = first; p < last; p++)
+		{
+			Registration registration;
+			registration.source = pairs[p].first;
+			registration.target = pairs[p].second;
+			registrations.push_back(registration);
+		}
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (int k = 0; k < static_cast<int>(registrations.size()); k++)
+		{
+#ifdef _OPENMP
+			RGBDOdometry &odometry = odometries[omp_get_thread_num()];
+#else
+			RGBDOdometry &odometry = odometries[0];
+#endif
+			Registration &registration = registrations[k];
+			const OdometryFrame *source = keyframes.at(registration.source).get();
+			const OdometryFrame *target = keyframes.at(registration.target).get();
+			if (!source || !target)
+				continue;
+
+			// Starts from the tracked poses, revisits are too far apart for the identity
+			LatencyRecorder::Scope scope(recorder, "loop_closure");
+			const Eigen::Matrix4d odo_init = trackedPoses_[registration.target] * trackedPoses_[registration.source].inverse();
+			std::tuple<bool, Eigen::Matrix4d, Eigen::Matrix6d> rgbd_odo =
+				odometry.compute(*source, *target, odo_init, option_);
+			std::tie(registration.isSuccess, registration.transform, registration.information) = rgbd_odo;
+		}
+
+		for (const Registration &registration : registrations)
+		{
+			const bool isConsecutive = (registration.target == registration.source + 1);
+			if (registration.isSuccess)
+			{
+				graph_.edges_.push_back(open3d::pipelines::registration::PoseGraphEdge(
+					registration.source, registration.target,
+					registration.transform, registration.information, !isConsecutive));
+			}
+			else if (isConsecutive)
+			{
+				// Keeps the graph connected, like a failed frame odometry
+				graph_.edges_.push_back(open3d::pipelines::registration::PoseGraphEdge(
+					registration.source, registration.target,
+					trackedPoses_[registration.target] * trackedPoses_[registration.source].inverse(),
+					Eigen::Matrix6d::Identity(), false));
+			}
+		}
+	}
+}
+
+std::vector<Eigen::Matrix4d> KeyframeGraph::getFramePoses(const std::vector<Eigen::Matrix4d> &trackedPoses) const
+{
+	std::vector<Eigen::Matrix4d> poses(trackedPoses.size());
+	size_t k = 0;
+	for (size_t i = 0; i < trackedPoses.size(); i++)
+	{
+		while (k + 1 < frameIndices_.size() && frameIndices_[k + 1] <= i)
+			k++;
+
+		if (frameIndices_.empty() || i < frameIndices_[0])
+			poses[i] = trackedPoses[i].inverse();
+		else
+			poses[i] = graph_.nodes_[k].pose_ * trackedPoses_[k] * trackedPoses[i].inverse();
+	}
+	return poses;
+}
+
+void KeyframeGraph::clear()
+{
+	{
+		std::unique_lock<std::mutex> lock(pendingMutex_);
+		pendingFrameIndices_.clear();
+		pendingPoses_.clear();
+	}
+
+	frameIndices_.clear();
+	trackedPoses_.clear();
+	index_.clear();
+	graph_ = open3d::pipelines::registration::PoseGraph();
+}
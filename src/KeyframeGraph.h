@@ -0,0 +1,82 @@
+#ifndef KEYFRAMEGRAPH_H
+#define KEYFRAMEGRAPH_H
+
+#include "FrameStore.h"
+#include "LoopClosureIndex.h"
+#include "LatencyRecorder.h"
+
+#include "open3d/Open3D.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
+/**
+ * Pose graph over the keyframes of a scan, built up while scanning.
+ *
+ * The odometry adds keyframes as they are selected; update() registers them
+ * with the previous keyframes and with earlier ones proposed by a
+ * LoopClosureIndex, and reoptimizes the graph starting from the last
+ * solution. Called regularly from a background thread, only the keyframes
+ * since the last call remain to be done when the scan is saved.
+ *
+ * Frames between two keyframes follow the correction of the keyframe before
+ * them, see getFramePoses().
+ */
+class KeyframeGraph
+{
+public:
+	explicit KeyframeGraph(FrameStore &frameStore);
+
+	void setIntrinsic(const open3d::camera::PinholeCameraIntrinsic &intrinsic) { intrinsic_ = intrinsic; }
+	void setLoopClosureSearch(double radius, double maxAngle, double minSimilarity)
+	{
+		index_.setSearchRadius(radius, maxAngle);
+		index_.setMinSimilarity(minSimilarity);
+	}
+	void setLatencyRecorder(const std::shared_ptr<LatencyRecorder> &latencyRecorder) { latencyRecorder_ = latencyRecorder; }
+
+	/**
+	 * Queues a keyframe with its tracked pose (extrinsic) for the next update().
+	 * Keyframes must be added in frame order. Can be called from any thread.
+	 */
+	void addKeyframe(size_t frameIndex, const Eigen::Matrix4d &pose);
+	size_t getPendingKeyframes();
+
+	/**
+	 * Adds the queued keyframes to the graph and optimizes it.
+	 *
+	 * Must not run concurrently with itself, getFramePoses() or clear().
+	 */
+	void update();
+
+	/**
+	 * Optimized poses (camera to world) of all frames, given their tracked
+	 * poses (extrinsics). Frames before the first keyframe keep their pose.
+	 */
+	std::vector<Eigen::Matrix4d> getFramePoses(const std::vector<Eigen::Matrix4d> &trackedPoses) const;
+
+	size_t size() const { return frameIndices_.size(); }
+	void clear();
+
+private:
+	void registerPairs(const std::vector<std::pair<size_t, size_t> > &pairs);
+
+	FrameStore &frameStore_;
+	open3d::camera::PinholeCameraIntrinsic intrinsic_;
+	open3d::pipelines::odometry::OdometryOption option_;
+	std::shared_ptr<LatencyRecorder> latencyRecorder_;
+
+	std::mutex pendingMutex_;
+	std::vector<size_t> pendingFrameIndices_;
+	std::vector<Eigen::Matrix4d> pendingPoses_;
+
+	// Only accessed by update() and its callers, per keyframe
+	std::vector<size_t> frameIndices_;
+	std::vector<Eigen::Matrix4d> trackedPoses_;
+	LoopClosureIndex index_;
+	open3d::pipelines::registration::PoseGraph graph_;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include "LatencyRecorder.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+#ifdef _WIN32
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#	include <psapi.h>
+#else
+#	include <sys/resource.h>
+#endif
+
+void LatencyRecorder::record(const std::string &stage, double milliseconds)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	samples_[stage].push_back(milliseconds);
+}
+
+void LatencyRecorder::clear()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	samples_.clear();
+}
+
+/**
+ * Percentiles use the nearest rank, so they are always one of the samples.
+ */
+std::map<std::string, LatencyRecorder::Summary> LatencyRecorder::getSummaries()
+{
+	std::map<std::string, std::vector<double> > samples;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		samples = samples_;
+	}
+
+	std::map<std::string, Summary> summaries;
+	for(auto &stage : samples)
+	{
+		std::vector<double> &values = stage.second;
+		if(values.empty())
+			continue;
+		std::sort(values.begin(), values.end());
+
+		auto percentile = [&values](double p)
+		{
+			const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(values.size())));
+			return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1];
+		};
+
+		Summary summary;
+		summary.count = values.size();
+		summary.mean = std::accumulate(values.begin(), values.end(), 0.0) / static_cast<double>(values.size());
+		summary.p50 = percentile(50);
+		summary.p95 = percentile(95);
+		summary.p99 = percentile(99);
+		summary.max = values.back();
+		summaries[stage.first] = summary;
+	}
+	return summaries;
+}
+
+void LatencyRecorder::writeJSON(std::ostream &out, const std::string &indent)
+{
+	const auto summaries = getSummaries();
+
+	out << "{";
+	bool isFirst = true;
+	for(const auto &stage : summaries)
+	{
+		const Summary &summary = stage.second;
+		out << (isFirst ? "\n" : ",\n") << indent << "\t\"" << stage.first << "\": { "
+			<< "\"count\": " << summary.count
+			<< ", \"mean_ms\": " << summary.mean
+			<< ", \"p50_ms\": " << summary.p50
+			<< ", \"p95_ms\": " << summary.p95
+			<< ", \"p99_ms\": " << summary.p99
+			<< ", \"max_ms\": " << summary.max << " }";
+		isFirst = false;
+	}
+	out << "\n" << indent << "}";
+}
+
+size_t LatencyRecorder::getPeakResidentSetSize()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#	ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss);		// Bytes
+#	else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;	// Kilobytes
+#	endif
+#endif
+}
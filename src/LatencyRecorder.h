@@ -0,0 +1,78 @@
+#ifndef LATENCYRECORDER_H
+#define LATENCYRECORDER_H
+
+#include "Trace.h"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <cstddef>
+
+/**
+ * Collects the time spent in the processing stages, for benchmarks.
+ *
+ * Every stage gets one sample per run (e.g. per frame), the distribution is
+ * reported as percentiles. Thread-safe.
+ */
+class LatencyRecorder
+{
+public:
+	struct Summary
+	{
+		size_t count{ 0 };
+		double mean{ 0 }, p50{ 0 }, p95{ 0 }, p99{ 0 }, max{ 0 };	//!< Milliseconds
+	};
+
+	/**
+	 * Measures the time until it goes out of scope. Without a recorder, it is
+	 * only a trace event (see Trace).
+	 */
+	class Scope
+	{
+	public:
+		Scope(LatencyRecorder *recorder, const char *stage)
+			: traceScope_(stage), recorder_(recorder), stage_(stage)
+		{
+			if(recorder_ != nullptr)
+				startTime_ = std::chrono::steady_clock::now();
+		}
+		~Scope()
+		{
+			if(recorder_ != nullptr)
+			{
+				recorder_->record(stage_, std::chrono::duration<double, std::milli>(
+					std::chrono::steady_clock::now() - startTime_).count());
+			}
+		}
+
+	private:
+		Trace::Scope traceScope_;
+		LatencyRecorder *recorder_;
+		const char *stage_;
+		std::chrono::steady_clock::time_point startTime_;
+	};
+
+	void record(const std::string &stage, double milliseconds);
+	void clear();
+
+	std::map<std::string, Summary> getSummaries();
+
+	/**
+	 * Writes the summaries as a JSON object, one member per stage.
+	 */
+	void writeJSON(std::ostream &out, const std::string &indent = "");
+
+	/**
+	 * Peak resident set size of this process in bytes, 0 if unknown.
+	 */
+	static size_t getPeakResidentSetSize();
+
+private:
+	std::mutex mutex_;
+	std::map<std::string, std::vector<double> > samples_;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "LoopClosureIndex.h"
+
+#include <open3d/geometry/KDTreeFlann.h>
+
+#include <cmath>
+#include <algorithm>
+
+// Nearest neighbours looked at per keyframe, bounds the query time when the camera stays in one place
+static const int maxNeighbours = 64;
+
+void LoopClosureIndex::add(const Eigen::Matrix4d &pose, const std::vector<float> &descriptor)
+{
+	// The pose maps world to camera coordinates
+	const Eigen::Matrix3d rotation = pose.block<3, 3>(0, 0);
+	positions_.push_back(-rotation.transpose() * pose.block<3, 1>(0, 3));
+	directions_.push_back(rotation.transpose().col(2));
+	descriptors_.push_back(descriptor);
+}
+
+void LoopClosureIndex::clear()
+{
+	positions_.clear();
+	directions_.clear();
+	descriptors_.clear();
+}
+
+std::vector<std::pair<size_t, size_t> > LoopClosureIndex::findCandidates(size_t minDistance, size_t first) const
+{
+	std::vector<std::pair<size_t, size_t> > candidates;
+	if(positions_.size() < 2 || first >= positions_.size())
+		return candidates;
+
+	Eigen::MatrixXd points(3, positions_.size());
+	for(size_t i = 0; i < positions_.size(); i++)
+		points.col(i) = positions_[i];
+	const open3d::geometry::KDTreeFlann kdTree(points);
+
+	// Distance travelled since the first keyframe
+	std::vector<double> pathLengths(positions_.size(), 0.0);
+	for(size_t i = 1; i < positions_.size(); i++)
+		pathLengths[i] = pathLengths[i - 1] + (positions_[i] - positions_[i - 1]).norm();
+
+	const double minCosAngle = std::cos(maxAngle_);
+	std::vector<int> indices;
+	std::vector<double> distances2;
+	std::vector<std::pair<double, size_t> > matches;
+	for(size_t b = first; b < positions_.size(); b++)
+	{
+		kdTree.SearchHybrid(positions_[b], radius_, maxNeighbours, indices, distances2);
+
+		matches.clear();
+		for(int index : indices)
+		{
+			// Each pair once, from its later keyframe
+			const size_t a = static_cast<size_t>(index);
+			if(a >= b || b - a < minDistance)
+				continue;
+			// Near in space only because the camera has not got far yet, not a revisit
+			if(pathLengths[b] - pathLengths[a] < 2.0 * radius_)
+				continue;
+			if(directions_[a].dot(directions_[b]) < minCosAngle)
+				continue;
+
+			double similarity = 1.0;
+			if(!descriptors_[a].empty() && !descriptors_[b].empty())
+			{
+				similarity = computeSimilarity(descriptors_[a], descriptors_[b]);
+				if(similarity < minSimilarity_)
+					continue;
+			}
+			matches.push_back(std::make_pair(similarity, a));
+		}
+
+		// Most similar first, ties by index so the result is deterministic
+		std::sort(matches.begin(), matches.end(),
+			[](const std::pair<double, size_t> &m1, const std::pair<double, size_t> &m2)
+			{
+				return m1.first > m2.first || (m1.first == m2.first && m1.second < m2.second);
+			});
+		if(matches.size() > maxCandidates_)
+			matches.resize(maxCandidates_);
+		for(const auto &match : matches)
+			candidates.push_back(std::make_pair(match.second, b));
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+	return candidates;
+}
+
+/**
+ * Descriptors are zero mean and unit length, so the dot product is their normalized cross-correlation.
+ */
+double LoopClosureIndex::computeSimilarity(const std::vector<float> &a, const std::vector<float> &b)
+{
+	if(a.size() != b.size())
+		return 0;
+
+	double sum = 0;
+	for(size_t i = 0; i < a.size(); i++)
+		sum += static_cast<double>(a[i]) * static_cast<double>(b[i]);
+	return sum;
+}
@@ -0,0 +1,71 @@
+#ifndef LOOPCLOSUREINDEX_H
+#define LOOPCLOSUREINDEX_H
+
+#include <Eigen/Core>
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/**
+ * Proposes keyframe pairs that probably see the same part of the scene
+ * again after the camera went elsewhere.
+ *
+ * The camera positions go into a KD-tree, so each keyframe is only compared
+ * with its nearest neighbours in space instead of all other keyframes. A
+ * neighbour is proposed if the cameras look in a similar direction and the
+ * images look alike, compared by a small global descriptor (see
+ * FrameStore::getDescriptor()). Building and querying takes O(n log n).
+ */
+class LoopClosureIndex
+{
+public:
+	/**
+	 * Cameras farther apart than radius (in metres), or with viewing directions
+	 * differing by more than maxAngle (in radians), are never proposed.
+	 */
+	void setSearchRadius(double radius, double maxAngle)
+	{
+		radius_ = radius;
+		maxAngle_ = maxAngle;
+	}
+	/**
+	 * Minimum normalized cross-correlation of the descriptors, in [-1, 1].
+	 */
+	void setMinSimilarity(double minSimilarity) { minSimilarity_ = minSimilarity; }
+	/**
+	 * At most this many earlier keyframes are proposed per keyframe, the most similar ones.
+	 */
+	void setMaxCandidates(size_t maxCandidates) { maxCandidates_ = maxCandidates; }
+
+	/**
+	 * Adds a keyframe with its pose (extrinsic) and descriptor. The descriptor
+	 * may be empty, then only the pose is checked.
+	 */
+	void add(const Eigen::Matrix4d &pose, const std::vector<float> &descriptor);
+	size_t size() const { return positions_.size(); }
+	void clear();
+
+	/**
+	 * Pairs (a, b) with a < b and b >= first, in positions of add() order,
+	 * sorted. Keyframes less than minDistance apart in that order are
+	 * skipped, they are registered anyway, as are those between which the
+	 * camera travelled less than twice the search radius.
+	 *
+	 * The KD-tree is rebuilt on every call, so keyframes can be added in
+	 * between; passing the first new keyframe only looks for their revisits.
+	 */
+	std::vector<std::pair<size_t, size_t> > findCandidates(size_t minDistance, size_t first = 0) const;
+
+	static double computeSimilarity(const std::vector<float> &a, const std::vector<float> &b);
+
+private:
+	double radius_{ 0.5 }, maxAngle_{ 0.6 };
+	double minSimilarity_{ 0.5 };
+	size_t maxCandidates_{ 2 };
+
+	std::vector<Eigen::Vector3d> positions_, directions_;	// Camera centres and optical axes
+	std::vector<std::vector<float> > descriptors_;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "ONI3DConverter.h"
 
 #include "Stitcher.h"
+#include "Trace.h"
 
 #if defined(_WIN32) && !defined(_MSC_VER)
 #	define _MSC_VER 1300
@@ -8,11 +9,14 @@
 #include <OpenNI.h>
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
 #include "open3d/Open3D.h"
 
 ONI3DConverter::ONI3DConverter()
-	: ConverterInterface(), resX_(0), resY_(0), factorXZ_(0), factorYZ_(0),
+	: ConverterInterface(), colorRing_(frameRingCapacity_), depthRing_(frameRingCapacity_),
+	resX_(0), resY_(0), factorXZ_(0), factorYZ_(0),
 	convTermsSet_(false), terminate_(false)
 {
 }
@@ -53,247 +57,189 @@ void ONI3DConverter::cleanup()
 	std::cout << "Number of frames: " << numberOfFrames_
 		<< " ("
 		<< static_cast<double>(numberOfFrames_) / totalSeconds
-		<< " fps)" << std::endl;
+		<< " fps), dropped: " << droppedFrames_
+		<< ", pairs: " << frameSynchronizer_.getNumberOfPairs()
+		<< ", unpaired depth: " << frameSynchronizer_.getDroppedDepthFrames()
+		<< ", unpaired color: " << frameSynchronizer_.getDroppedColorFrames() << std::endl;
 }
 
-void ONI3DConverter::newColorFrame(int frameIndex, int width, int height, int stride, int size, const void *data,
-	const openni::VideoStream *pvS)
+/**
+ * Copies a shared frame into an Open3D image owned by the Converter thread.
+ */
+void ONI3DConverter::copyFrameToImage(const FrameHandle &frame, open3d::geometry::Image &image,
+	int numOfChannels, int bytesPerChannel)
 {
-	std::unique_lock<std::mutex> lock(mutex_);
-
-	colorData_.ensureSize(size);
-	memcpy(colorData_.data_, data, size);
-	colorData_.frameIndex_ = frameIndex;
-	colorData_.width_ = width;
-	colorData_.height_ = height;
-	colorData_.stride_ = stride;
+	const int width = frame.getWidth(), height = frame.getHeight();
+	const int stride = frame.getStrideInBytes(), size = frame.getDataSize();
+	image.Prepare(width, height, numOfChannels, bytesPerChannel);
+
+	const int lineSize = width * numOfChannels * bytesPerChannel;
+	unsigned char *dataPtr = image.PointerAt<unsigned char>(0, 0, 0);
+	const unsigned char *srcPtr = reinterpret_cast<const unsigned char *>(frame.getData());
+	if(stride == lineSize)
+	{
+		memcpy(dataPtr, srcPtr, std::min(size, lineSize * height));
+	}
+	else
+	{
+		const int numLines = std::min(height, (size - lineSize) / stride + 1);
+		for(int y = 0; y < numLines; y++)
+			memcpy(dataPtr + y * lineSize, srcPtr + y * stride, lineSize);
+	}
+}
 
-	colorImg_.Prepare(width, height, 3, 1);
-	unsigned char *dataPtr = colorImg_.PointerAt<unsigned char>(0, 0, 0);
-	memcpy(dataPtr, data, size);
+void ONI3DConverter::newColorFrame(const FrameHandle &frame, const openni::VideoStream *pvS)
+{
+	FrameHandle *pSlot = colorRing_.beginWrite();
+	if(pSlot == nullptr)
+	{
+		// Converter thread is behind, drop the frame instead of blocking the driver
+		droppedFrames_++;
+		return;
+	}
+	*pSlot = frame;
+	colorRing_.commitWrite();
 
 	// Alert Converter thread of new data
 	mutexCond_.notify_one();
 }
 
-void ONI3DConverter::newDepthFrame(int frameIndex, int width, int height, int stride, int size, const void *data,
-	const openni::VideoStream *pVS)
+void ONI3DConverter::newDepthFrame(const FrameHandle &frame, const openni::VideoStream *pVS)
 {
-	std::unique_lock<std::mutex> lock(mutex_);
+	const int width = frame.getWidth(), height = frame.getHeight();
 
 	numberOfFrames_++;
 
-	depthData_.ensureSize(size);
-	memcpy(depthData_.data_, data, size);
-	depthData_.frameIndex_ = frameIndex;
-	depthData_.width_ = width;
-	depthData_.height_ = height;
-	depthData_.stride_ = stride;
-
-	depthImg_.Prepare(width, height, 1, 2);
-	unsigned char* dataPtr = depthImg_.PointerAt<unsigned char>(0, 0, 0);
-	memcpy(dataPtr, data, size);
-
-	if(!convTermsSet_)
+	// Intrinsics are set up before the first frame is published to the Converter thread
+	if(!convTermsSet_ && pVS == nullptr)
+	{
+		// Replayed sequences have no stream to ask, use the configured intrinsics (y pointing up)
+		startTime_ = std::chrono::steady_clock::now();
+		backProjection_.setup(width, height, fx_, -fy_, cx_, cy_);
+		convTermsSet_ = true;
+	}
+	else if(!convTermsSet_)
 	{
 		startTime_ = std::chrono::steady_clock::now();
 
+		// OpenNI projects as worldX = (x/resX - 0.5)*z*factorXZ, worldY = (0.5 - y/resY)*z*factorYZ,
+		// so two probes are enough to recover it
 		float worldX = 0, worldY = 0, worldZ = 0;
-		openni::Status rc = openni::CoordinateConverter::convertDepthToWorld(
+		openni::CoordinateConverter::convertDepthToWorld(
 			*pVS, 0, 0, 1,
 			&worldX, &worldY, &worldZ);
 		factorXZ_ = worldX * (-2.0f);
 		factorYZ_ = worldY * 2.0f;
 
-		rc = openni::CoordinateConverter::convertDepthToWorld(
+		openni::CoordinateConverter::convertDepthToWorld(
 			*pVS, 1, 1, 1,
 			&worldX, &worldY, &worldZ);
 		resX_ = 1.0f/(0.5f + worldX/factorXZ_);
 		resY_ = 1.0f/(0.5f - worldY/factorYZ_);
 
-		/*std::cout << "factorXZ: " << factorXZ_ << ", factorYZ: " << factorYZ_ << std::endl;
-		std::cout << "resX: " << resX_ << ", resY: " << resY_ << std::endl;
-		*/
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, 0, 0,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 1, 0, 0,
-			&worldX, &worldY, &worldZ);
-
-		focalX_ = worldX;
-
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, 1, 0,
-			&worldX, &worldY, &worldZ);
-
-		focalY_ = worldY;
-
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, 0, 1,
-			&worldX, &worldY, &worldZ);
-
-		pX_ = worldX;
-		pY_ = worldY;
-
-		/*std::cout << "focalX: " << focalX_
-			<< ", focalY:" << focalY_
-			<< ", pX:" << pX_
-			<< ", pY:" << pY_
-			<< std::endl;*/
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 1, 0, 1,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, 1, 1,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 1, 1, 0,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 1, 1, 1,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, 0, 2,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 1, 0, 2,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, 1, 2,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 1, 1, 2,
-			&worldX, &worldY, &worldZ);
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 2, 1, 2,
-			&worldX, &worldY, &worldZ);
-
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, width/2, height/2, 0,
-			&worldX, &worldY, &worldZ);
-
-		float checkX, checkY;
-		checkX = (2.0f / resX_ - 0.5f)*2.0f*factorXZ_;
-		checkY = (0.5f - 1.0f/resY_)*2.0f*factorYZ_;
-
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 2, 2, 2,
-			&worldX, &worldY, &worldZ);
-
-		if (openni::Status::STATUS_OK == openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, 0, 100,
-			&worldX, &worldY, &worldZ))
-			std::cout << "left top: " << worldX << "/" << worldY << "/" << worldZ << std::endl;
-		if (openni::Status::STATUS_OK == openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, 0, 1000,
-			&worldX, &worldY, &worldZ))
-			std::cout << "left top: " << worldX << "/" << worldY << "/" << worldZ << std::endl;
-		//if (openni::Status::STATUS_OK == openni::CoordinateConverter::convertDepthToWorld(
-		//	*pVS, width - 1, 0, 100,
-		//	&worldX, &worldY, &worldZ))
-		//	std::cout << "right top: " << worldX << "/" << worldY << "/" << worldZ << std::endl;
-		if (openni::Status::STATUS_OK == openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, width - 1, 0, 1000,
-			&worldX, &worldY, &worldZ))
-			std::cout << "right top: " << worldX << "/" << worldY << "/" << worldZ << std::endl;
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, 0, height-1, 1000,
-			&worldX, &worldY, &worldZ);
-		//std::cout << "left bottom: " << worldX << "/" << worldY << "/" << worldZ << std::endl;
-		rc = openni::CoordinateConverter::convertDepthToWorld(
-			*pVS, width-1, height-1, 1000,
-			&worldX, &worldY, &worldZ);
-		//std::cout << "right bottom: " << worldX << "/" << worldY << "/" << worldZ << std::endl;
+		// The same projection expressed as pinhole intrinsics (y pointing up)
+		backProjection_.setup(width, height,
+			resX_ / factorXZ_, -resY_ / factorYZ_,
+			0.5 * resX_, 0.5 * resY_);
 
 		convTermsSet_ = true;
 	}
 
+	FrameHandle *pSlot = depthRing_.beginWrite();
+	if(pSlot == nullptr)
+	{
+		// Converter thread is behind, drop the frame instead of blocking the driver
+		droppedFrames_++;
+		return;
+	}
+	*pSlot = frame;
+	depthRing_.commitWrite();
+
 	// Alert Converter thread of new data
 	mutexCond_.notify_one();
 }
 
-void ONI3DConverter::get3DPoints(std::vector< SVector3f > &points,
-	std::vector< SVector3b > &colors)
+void ONI3DConverter::get3DPoints(PointCloudSoA &points)
 {
-	std::unique_lock<std::mutex> lock(mutex3D_);
+	TRACE_SCOPE("ONI3DConverter::get3DPoints");
+	std::unique_lock<std::mutex> lock(mutex3D_, std::defer_lock);
+	{
+		TRACE_SCOPE("wait mutex3D_");
+		lock.lock();
+	}
 	points = points_;
-	colors = colors_;
 }
 
 void ONI3DConverter::Entry()
 {
 	bool terminate = false;
-	int processedFrameIndex = 0;
-	std::vector< SVector3f > points;
-	std::vector< SVector3b > colors;
+	PointCloudSoA points;
+	Trace::setThreadName("ONI3DConverter");
 
 	while(!terminate)
 	{
 		// Wait for new data
+		FrameHandle depthFrame, colorFrame;
+		bool hasPair = false;
 		{
 			std::unique_lock<std::mutex> lock(mutex_);
-			while((depthData_.data_ == NULL
-					|| colorData_.data_ == NULL
-					|| depthData_.frameIndex_ != colorData_.frameIndex_
-					|| processedFrameIndex >= depthData_.frameIndex_)
-				&& !terminate_)
-			{
-				mutexCond_.wait(lock);
-			}
-			if(!terminate_)
-			{
-				// Copy data locally
-				depthDataCopy_.copy( depthData_ );
-				colorDataCopy_.copy( colorData_ );
-			}
-			else
+			while(!terminate_)
 			{
-				terminate = true;
+				// Set before the rings are drained, so isBacklogged() never sees empty
+				// rings while the frames taken from them are not handed over yet
+				isConverting_ = true;
+
+				// Move the new frames from the rings into the synchronizer
+				for(FrameHandle *pSlot = depthRing_.front(); pSlot != nullptr; pSlot = depthRing_.front())
+				{
+					frameSynchronizer_.addDepthFrame(*pSlot);
+					*pSlot = FrameHandle();
+					depthRing_.pop();
+				}
+				for(FrameHandle *pSlot = colorRing_.front(); pSlot != nullptr; pSlot = colorRing_.front())
+				{
+					frameSynchronizer_.addColorFrame(*pSlot);
+					*pSlot = FrameHandle();
+					colorRing_.pop();
+				}
+
+				if(frameSynchronizer_.getPair(depthFrame, colorFrame))
+				{
+					hasPair = true;
+					break;
+				}
+				isConverting_ = false;
+
+				// The producers notify without holding the mutex, so a wakeup might be
+				// missed in rare cases; the timeout bounds the resulting delay
+				mutexCond_.wait_for(lock, std::chrono::milliseconds(5));
 			}
+			terminate = terminate_;
 		}
 
-		if(!terminate)
+		// A pair that was already taken is finished even when terminating
+		if(hasPair)
 		{
-			// Process data
-#if 0
-			openni::DepthPixel *pDepthData = reinterpret_cast<openni::DepthPixel *>(depthDataCopy_.data_);
-			uint8_t *pColorData = reinterpret_cast<uint8_t *>(colorDataCopy_.data_);
-			int depthStride = depthDataCopy_.stride_ / sizeof(openni::DepthPixel);
-			int colorStride = colorDataCopy_.stride_;
-			points.clear();
-			colors.clear();
+			TRACE_SCOPE("ONI3DConverter::convert");
 
+			// Copy the shared frames into the images handed to the stitcher, then
+			// release the handles right away so the driver buffers are free again
+			{
+				LatencyRecorder::Scope scope(latencyRecorder_.get(), "copy");
+				copyFrameToImage(depthFrame, depthImg_, 1, 2);
+				copyFrameToImage(colorFrame, colorImg_, 3, 1);
+				depthFrame = FrameHandle();
+				colorFrame = FrameHandle();
+			}
 
-			for(int y = 0; y < depthDataCopy_.height_; y++)
+			// Process data
+			if(computePoints_)
 			{
-				openni::DepthPixel *pCurDepthLine = pDepthData + y * depthStride;
-				uint8_t *pCurColorLine = pColorData + y * colorStride;
-				for(int x = 0; x < depthDataCopy_.width_; x++)
-				{
-					openni::DepthPixel curDepthValue = pCurDepthLine[x];
-					if(curDepthValue > 0)
-					{
-						float worldX, worldY, worldZ;
-/*						openni::Status rc = openni::CoordinateConverter::convertDepthToWorld(
-							*depthVideoStream_, x, y, curDepthValue,
-							&worldX, &worldY, &worldZ);
-*/
-						worldX = (static_cast<float>(x) / resX_ - 0.5f)*static_cast<float>(curDepthValue)*factorXZ_;
-						worldY = (0.5f - static_cast<float>(y)/resY_)*static_cast<float>(curDepthValue)*factorYZ_;
-						worldZ = static_cast<float>(curDepthValue);
-/*
-						char buf[1024];
-						sprintf_s(buf, 1024, "%g\t%g\t%g\n", worldX, worldY, worldZ);
-						OutputDebugStringA(buf);*/
-
-						uint8_t *pCurPixelColor = pCurColorLine + 3*x;
-						points.push_back( SVector3f(worldX, worldY, worldZ) );
-						colors.push_back( SVector3b(pCurPixelColor[0], pCurPixelColor[1], pCurPixelColor[2]) );
-					}
-				}
+				// Points are in depth units (mm), y pointing up
+				DepthToPointCloud::convert(depthImg_.PointerAt<uint16_t>(0, 0), depthImg_.width_,
+					colorImg_.data_.data(), colorImg_.BytesPerLine(),
+					backProjection_, 1.0f, points);
 			}
-#endif
 			// Run stitchingtest
 //			stitchingTest_.runTest(points_, colors_, points, colors);
 			if (pStitcher_ != nullptr)
@@ -301,12 +247,14 @@ void ONI3DConverter::Entry()
 
 			// Copy points over
 			{
-				std::unique_lock<std::mutex> lock(mutex3D_);
-				points_ = points;
-				colors_ = colors;
+				std::unique_lock<std::mutex> lock(mutex3D_, std::defer_lock);
+				{
+					TRACE_SCOPE("wait mutex3D_");
+					lock.lock();
+				}
+				std::swap(points_, points);
 			}
-
-			processedFrameIndex = depthDataCopy_.frameIndex_;
 		}
+		isConverting_ = false;
 	}
 }
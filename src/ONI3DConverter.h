@@ -3,10 +3,16 @@
 
 #include "ConverterInterface.h"
 
-#include "Vector.h"
+#include "DepthToPointCloud.h"
+#include "FrameRing.h"
+#include "FrameSynchronizer.h"
+#include "BackProjectionTable.h"
+#include "LatencyRecorder.h"
 
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <thread>
 #include <memory>
 #include <chrono>
@@ -30,70 +36,85 @@ public:
 	virtual void setup(StitcherI* pStitcher);
 	virtual void cleanup();
 
-	virtual void newColorFrame(int frameIndex, int width, int height, int stride, int size, const void *data,
-		const openni::VideoStream *pVS);
-	virtual void newDepthFrame(int frameIndex, int width, int height, int stride, int size, const void *data,
-		const openni::VideoStream *pVS);
+	virtual void newColorFrame(const FrameHandle &frame, const openni::VideoStream *pVS);
+	virtual void newDepthFrame(const FrameHandle &frame, const openni::VideoStream *pVS);
+	// The rings are read before isConverting_, which the Converter thread sets before draining them
+	virtual bool isBacklogged() const { return !depthRing_.empty() || !colorRing_.empty() || isConverting_; }
 
-	void get3DPoints(std::vector< SVector3f > &points,
-		std::vector< SVector3b > &colors);
+	/**
+	 * Number of frames dropped because a ring was full.
+	 */
+	int getDroppedFrames() const { return droppedFrames_; }
 
-protected:
-	void Entry();
+	/**
+	 * Maximum timestamp difference (in microseconds) between a depth and a color frame of one pair.
+	 *
+	 * Must be called before setup().
+	 */
+	void setPairingTolerance(uint64_t tolerance) { frameSynchronizer_.setTolerance(tolerance); }
 
-private:
+	/**
+	 * Enables converting every frame pair into a point cloud, see get3DPoints().
+	 */
+	void setComputePoints(bool computePoints) { computePoints_ = computePoints; }
 
 	/**
-	 * DataStruct holds raw sensor data.
+	 * Pinhole intrinsics of the depth camera, only used for frames without a
+	 * video stream (replayed sequences). Must be called before the first frame.
 	 */
-	class DataStruct
+	void setDepthIntrinsics(double fx, double fy, double cx, double cy)
 	{
-	public:
-		DataStruct() : data_(NULL), dataSize_(0), frameIndex_(0), width_(0), height_(0), stride_(0) { }
-		~DataStruct() { free(data_); }
-		void ensureSize(int size)
-		{
-			if(dataSize_ < size || data_ == NULL)
-			{
-				free(data_);
-				data_ = malloc(size);
-				dataSize_ = size;
-			}
-		}
-		void copy(const DataStruct &other)
-		{
-			ensureSize(other.dataSize_);
-			memcpy(data_, other.data_, other.dataSize_);
-			frameIndex_ = other.frameIndex_;
-			width_ = other.width_;
-			height_ = other.height_;
-			stride_ = other.stride_;
-		}
-
-		void *data_;
-		int dataSize_, frameIndex_;
-		int width_, height_, stride_;
-	};
-
-	// Mutex between ViewerListener and 3DConverter threads
+		fx_ = fx;
+		fy_ = fy;
+		cx_ = cx;
+		cy_ = cy;
+	}
+
+	/**
+	 * Records the time spent copying the frames, nullptr disables it. Must be set before setup().
+	 */
+	void setLatencyRecorder(const std::shared_ptr<LatencyRecorder> &latencyRecorder) { latencyRecorder_ = latencyRecorder; }
+
+	void get3DPoints(PointCloudSoA &points);
+
+protected:
+	void Entry();
+
+private:
+
+	static void copyFrameToImage(const FrameHandle &frame, open3d::geometry::Image &image,
+		int numOfChannels, int bytesPerChannel);
+
+	// Frame rings between ViewerListener and 3DConverter threads (one producer per stream).
+	// The rings only hold handles, the pixel data is shared with the other converters.
+	static const size_t frameRingCapacity_ = 4;
+	FrameRing<FrameHandle> colorRing_, depthRing_;
+	std::atomic<int> droppedFrames_{ 0 };
+	// Set while a pair taken from the rings is on its way to the stitcher
+	std::atomic<bool> isConverting_{ false };
+
+	// Only used for waking up/terminating the Converter thread, never held while copying
 	std::mutex mutex_;
 	std::condition_variable mutexCond_;
-	DataStruct depthData_, colorData_;
 	float resX_, resY_, factorXZ_, factorYZ_;
-	float focalX_, focalY_, pX_, pY_;
 	bool convTermsSet_, terminate_;
-	open3d::geometry::Image colorImg_, depthImg_;
 
-	int numberOfFrames_{ 0 };
+	// Set up by the first depth frame, before it is published to the Converter thread
+	BackProjectionTable backProjection_;
+	double fx_{ 525.0 }, fy_{ 525.0 }, cx_{ 319.5 }, cy_{ 239.5 };
+
+	std::atomic<int> numberOfFrames_{ 0 };
+	std::shared_ptr<LatencyRecorder> latencyRecorder_;
+	std::atomic<bool> computePoints_{ false };
 	std::chrono::time_point<std::chrono::steady_clock> startTime_;
 
 	// Mutex between 3DConverter and 3D Data consumer threads
 	std::mutex mutex3D_;
-	std::vector< SVector3f > points_;
-	std::vector< SVector3b > colors_;
+	PointCloudSoA points_;
 
 	// Only accessed by Converter thread
-	DataStruct depthDataCopy_, colorDataCopy_;
+	FrameSynchronizer frameSynchronizer_;
+	open3d::geometry::Image colorImg_, depthImg_;
 
 	std::thread *thread_{nullptr};
 
@@ -29,12 +29,14 @@ ONIDevice::ONIDevice()
 ONIDevice::~ONIDevice()
 {
 	if(pDepth_ != NULL
-		&& pDepthListener_ != NULL)
+		&& pDepthListener_ != NULL
+		&& !isManualPlayback_)
 	{
 		pDepth_->removeNewFrameListener(pDepthListener_);
 	}
 	if(pColor_ != NULL
-		&& pColorListener_ != NULL)
+		&& pColorListener_ != NULL
+		&& !isManualPlayback_)
 	{
 		pColor_->removeNewFrameListener(pColorListener_);
 	}
@@ -49,9 +51,86 @@ ONIDevice::~ONIDevice()
 
 bool ONIDevice::connectDevice()
 {
-	openni::Status rc = openni::STATUS_OK;
+	return openDevice(openni::ANY_DEVICE);
+}
+
+/**
+ * Opens an .oni recording instead of a sensor.
+ *
+ * In real-time mode the frames are delivered at the recorded rate by OpenNI's
+ * callbacks. Otherwise the recording is played back manually: nothing is
+ * delivered until readRecordedFrame() is called, so the caller sets the pace.
+ * The recording is played once, starting with resume(), so no frames are
+ * lost before the converters are set.
+ */
+bool ONIDevice::connectRecording(const std::string &filename, bool realTime)
+{
+	if(!openDevice(filename.c_str()))
+		return false;
+
+	openni::PlaybackControl *pPlaybackControl = pDevice_->getPlaybackControl();
+	if(pPlaybackControl == nullptr)
+		return false;
+
+	pPlaybackControl->setRepeatEnabled(false);
+	if(realTime)
+	{
+		pPlaybackControl->setSpeed(1.0f);
+	}
+	else
+	{
+		// A speed of 0 selects manual playback, where every readFrame() reads the
+		// next frame of the stream. The frames are read by readRecordedFrame().
+		pDepth_->removeNewFrameListener(pDepthListener_);
+		pColor_->removeNewFrameListener(pColorListener_);
+		pPlaybackControl->setSpeed(0.0f);
+		isManualPlayback_ = true;
+	}
+	numberOfRecordedFrames_ = pPlaybackControl->getNumberOfFrames(*pDepth_);
+	numberOfRecordedColorFrames_ = pPlaybackControl->getNumberOfFrames(*pColor_);
 
-	const char* deviceURI = openni::ANY_DEVICE;
+	pause();
+	pPlaybackControl->seek(*pDepth_, 0);
+	return true;
+}
+
+/**
+ * Reads the next depth frame of a recording in manual playback, followed by
+ * the next color frame while there is one, and hands them to the converters
+ * on the calling thread.
+ *
+ * Returns false if no depth frame could be read.
+ */
+bool ONIDevice::readRecordedFrame()
+{
+	if(!isManualPlayback_ || pDepthListener_ == nullptr || pColorListener_ == nullptr)
+		return false;
+
+	const int lastFrameIndex = pDepthListener_->getLastFrameIndex();
+	pDepthListener_->onNewFrame(*pDepth_);
+	if(pDepthListener_->getLastFrameIndex() == lastFrameIndex)
+		return false;
+
+	if(pColorListener_->getLastFrameIndex() < numberOfRecordedColorFrames_)
+		pColorListener_->onNewFrame(*pColor_);
+	return true;
+}
+
+bool ONIDevice::isRecordingFinished() const
+{
+	return numberOfRecordedFrames_ > 0
+		&& pDepthListener_ != nullptr
+		&& pDepthListener_->getLastFrameIndex() >= numberOfRecordedFrames_;
+}
+
+int ONIDevice::getLastFrameIndex() const
+{
+	return pDepthListener_ != nullptr ? pDepthListener_->getLastFrameIndex() : 0;
+}
+
+bool ONIDevice::openDevice(const char *deviceURI)
+{
+	openni::Status rc = openni::STATUS_OK;
 
 	if(pDevice_ == NULL)
 		pDevice_ = new openni::Device();
@@ -129,10 +208,14 @@ bool ONIDevice::connectDevice()
 		}
 	}
 
+	// The video modes of a recording are fixed
+	const bool isFile = pDevice_->isFile();
+
 	rc = pDepth_->create(*pDevice_, openni::SENSOR_DEPTH);
 	if (rc == openni::STATUS_OK)
 	{
-		rc = pDepth_->setVideoMode(videoModesDepth[bestDepthIndex]);
+		if (!isFile)
+			rc = pDepth_->setVideoMode(videoModesDepth[bestDepthIndex]);
 		if (rc == openni::STATUS_OK)
 		{
 			rc = pDepth_->start();
@@ -153,7 +236,8 @@ bool ONIDevice::connectDevice()
 	rc = pColor_->create(*pDevice_, openni::SENSOR_COLOR);
 	if (rc == openni::STATUS_OK)
 	{
-		rc = pColor_->setVideoMode(videoModesColor[bestColorIndex]);
+		if (!isFile)
+			rc = pColor_->setVideoMode(videoModesColor[bestColorIndex]);
 		if(rc == openni::STATUS_OK)
 		{
 			rc = pColor_->start();
@@ -210,13 +294,16 @@ bool ONIDevice::connectDevice()
 void ONIDevice::disconnectDevice()
 {
 	deviceRunning_ = false;
+	numberOfRecordedFrames_ = 0;
+	numberOfRecordedColorFrames_ = 0;
 
 	if(pDepth_ != nullptr)
 	{
 		if(pDepthListener_ != nullptr)
 		{
 			pDepthListener_->clearConverters();
-			pDepth_->removeNewFrameListener(pDepthListener_);
+			if(!isManualPlayback_)
+				pDepth_->removeNewFrameListener(pDepthListener_);
 		}
 		pDepth_->stop();
 		pDepth_->destroy();
@@ -226,7 +313,8 @@ void ONIDevice::disconnectDevice()
 		if(pColorListener_ != nullptr)
 		{
 			pColorListener_->clearConverters();
-			pDepth_->removeNewFrameListener(pColorListener_);
+			if(!isManualPlayback_)
+				pDepth_->removeNewFrameListener(pColorListener_);
 		}
 		pColor_->stop();
 		pColor_->destroy();
@@ -244,6 +332,7 @@ void ONIDevice::disconnectDevice()
 	pColor_ = nullptr;
 	delete pDevice_;
 	pDevice_ = nullptr;
+	isManualPlayback_ = false;
 }
 
 void ONIDevice::setConverter(ConverterInterface*pConverter)
@@ -262,6 +351,14 @@ void ONIDevice::pause()
 		pDepth_->stop();
 }
 
+bool ONIDevice::resume()
+{
+	if(pColor_ == nullptr || pDepth_ == nullptr)
+		return false;
+	return pDepth_->start() == openni::STATUS_OK
+		&& pColor_->start() == openni::STATUS_OK;
+}
+
 bool ONIDevice::initializeOpenNI()
 {
 	openni::Status rc = openni::OpenNI::initialize();
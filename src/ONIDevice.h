@@ -1,6 +1,8 @@
 #ifndef ONIDEVICE_H
 #define ONIDEVICE_H
 
+#include <string>
+
 class ONIListener;
 class ConverterInterface;
 namespace openni
@@ -19,9 +21,15 @@ public:
 	virtual ~ONIDevice();
 
 	bool connectDevice();
+	bool connectRecording(const std::string &filename, bool realTime);
+	bool isRecordingFinished() const;
+	int getNumberOfRecordedFrames() const { return numberOfRecordedFrames_; }
+	int getLastFrameIndex() const;
+	bool readRecordedFrame();
 	void disconnectDevice();
 	void setConverter(ConverterInterface *pConverter);
 	void pause();
+	bool resume();
 
 	float getDepthHFOV() const { return depthHFOV_; }
 	float getDepthVFOV() const { return depthVHFOV_; }
@@ -33,6 +41,8 @@ public:
 	static const char *getLastErrorString();
 
 private:
+	bool openDevice(const char *deviceURI);
+
 	bool deviceRunning_;
 	openni::Device *pDevice_;
 	openni::VideoStream *pDepth_, *pColor_;
@@ -40,6 +50,8 @@ private:
 
 	float depthHFOV_, depthVHFOV_;
 	int minDepthValue_, maxDepthValue_;
+	int numberOfRecordedFrames_{ 0 }, numberOfRecordedColorFrames_{ 0 };
+	bool isManualPlayback_{ false };
 
 	static bool staticInitialized_;
 	static int versionMajor_, versionMinor_, versionBuild_, versionMaintenance_;
@@ -3,10 +3,12 @@
 #undef min
 #undef max
 
-#include "ONI3DConverter.h"
+#include "ConverterInterface.h"
+#include "Trace.h"
 
 
 ONIListener::ONIListener()
+	: framePool_(FramePool::create())
 {
 }
 
@@ -16,31 +18,44 @@ ONIListener::~ONIListener()
 
 void ONIListener::onNewFrame( openni::VideoStream &vs )
 {
+	TRACE_SCOPE("ONIListener::onNewFrame");
+	static thread_local bool isThreadNamed = false;
+	if(!isThreadNamed && Trace::isEnabled())
+	{
+		Trace::setThreadName("OpenNI callback");
+		isThreadNamed = true;
+	}
+
 	openni::VideoFrameRef frame;
 	openni::Status rs = vs.readFrame(&frame);
-	int sz = frame.getDataSize();
-	int frameIndex = frame.getFrameIndex();
-	int height = frame.getHeight();
-	int width = frame.getWidth();
-	openni::SensorType sensorType = frame.getSensorType();
+	if(rs != openni::STATUS_OK)
+		return;
 
+	openni::SensorType sensorType = frame.getSensorType();
+	const int frameIndex = frame.getFrameIndex();
 
-	int stride = frame.getStrideInBytes();
-	uint64_t timeStamp = frame.getTimestamp();
-	const openni::VideoMode &videoMode = frame.getVideoMode();
-	openni::PixelFormat pixelFormat = videoMode.getPixelFormat();
+	// Wrap the driver frame once, all converters share the same buffer
+	FrameHandle handle;
+	if(FrameHandle::getNumberOfDriverFrames() < maxDriverFrames_)
+	{
+		handle = FrameHandle::fromVideoFrameRef(frame);
+	}
+	else
+	{
+		handle = FrameHandle::fromPool(*framePool_, frameIndex, frame.getTimestamp(),
+			frame.getWidth(), frame.getHeight(), frame.getStrideInBytes(),
+			frame.getDataSize(), frame.getData());
+		frame.release();
+	}
 
-	int fps = videoMode.getFps();
-	int resX = videoMode.getResolutionX();
-	int resY = videoMode.getResolutionY();
-	
 	for(auto pConverter : converters_)
 	{
 		if(sensorType == openni::SENSOR_COLOR)
-			pConverter->newColorFrame(frameIndex, width, height, stride, sz, frame.getData(), &vs);
+			pConverter->newColorFrame(handle, &vs);
 		else if(sensorType == openni::SENSOR_DEPTH)
-			pConverter->newDepthFrame(frameIndex, width, height, stride, sz, frame.getData(), &vs);
+			pConverter->newDepthFrame(handle, &vs);
 	}
+	lastFrameIndex_ = frameIndex;
 }
 
 void ONIListener::addConverter(ConverterInterface* pConverter)
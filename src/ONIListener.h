@@ -9,6 +9,10 @@ class ConverterInterface;
 #endif
 #include <OpenNI.h>
 #include <vector>
+#include <memory>
+#include <atomic>
+
+class FramePool;
 
 class ONIListener: public openni::VideoStream::NewFrameListener
 {
@@ -21,8 +25,24 @@ public:
 	void addConverter(ConverterInterface*pConverter);
 	void clearConverters();
 
+	/**
+	 * Maximum number of driver frames handed out at the same time (over all streams).
+	 *
+	 * If more frames are still referenced, the frame is copied into a pooled
+	 * buffer instead, so the driver never runs out of buffers.
+	 */
+	void setMaxDriverFrames(int maxDriverFrames) { maxDriverFrames_ = maxDriverFrames; }
+
+	/**
+	 * Index of the last frame received, 0 before the first frame.
+	 */
+	int getLastFrameIndex() const { return lastFrameIndex_; }
+
 private:
 	std::vector<ConverterInterface*> converters_;
+	std::shared_ptr<FramePool> framePool_;
+	int maxDriverFrames_{ 6 };
+	std::atomic<int> lastFrameIndex_{ 0 };
 };
 
 #endif
@@ -35,35 +35,49 @@ void ONIToQtConverter::cleanup()
 {
 }
 
-void ONIToQtConverter::newColorFrame(int frameIndex, int width, int height, int stride, int size, const void* data,
-	const openni::VideoStream* pVS)
+/**
+ * Releases the frame handle kept alive by a QImage.
+ */
+static void releaseFrameHandle(void* info)
 {
-	std::unique_lock<std::mutex> lock(mutex_);
+	delete reinterpret_cast<FrameHandle*>(info);
+}
 
-	if (colorData_.size() < size)
-		colorData_.resize(size);
+void ONIToQtConverter::newColorFrame(const FrameHandle& frame, const openni::VideoStream* pVS)
+{
+	// The QImage uses the shared frame buffer directly and keeps its own reference
+	// to it, so the buffer stays valid as long as any copy of the image exists
+	FrameHandle* pHandle = new FrameHandle(frame);
+	QImage colorImg(reinterpret_cast<const uchar*>(frame.getData()), frame.getWidth(), frame.getHeight(),
+		frame.getStrideInBytes(), QImage::Format::Format_RGB888, &releaseFrameHandle, pHandle);
 
-	memcpy(&(colorData_[0]), data, size);
+	std::unique_lock<std::mutex> lock(mutex_);
 
-	colorImg_ = QImage(&(colorData_[0]), width, height, stride, QImage::Format::Format_RGB888);
+	colorImg_ = colorImg;
 
 	emit colorFrameChanged();
 }
 
-void ONIToQtConverter::newDepthFrame(int frameIndex, int width, int height, int stride, int size, const void* data,
-	const openni::VideoStream* pVS)
+void ONIToQtConverter::newDepthFrame(const FrameHandle& frame, const openni::VideoStream* pVS)
 {
+	const int width = frame.getWidth(), height = frame.getHeight();
+
 	std::unique_lock<std::mutex> lock(mutex_);
 
-	// Convert 16 bits -> 8 bits
-	cv::Mat depth, depthO, depth8;
-	depth.create(height, width, CV_16UC1);
-	unsigned char* cvDPtr = depth.ptr<unsigned char>(0);
-	memcpy(cvDPtr, data, size);
+	// Convert 16 bits -> 8 bits, reading the shared frame buffer in place
+	cv::Mat depth(height, width, CV_16UC1, const_cast<void*>(frame.getData()),
+		static_cast<size_t>(frame.getStrideInBytes()));
+	cv::Mat depthO;
 
 	//double minVal = 0, maxVal = 0;
 	//cv::minMaxLoc(depth, &minVal, &maxVal);
 
+	if (depthData_.size() < width * height)
+		depthData_.resize(width * height);
+
+	// Write the 8 bit image directly into the buffer shown by the label
+	cv::Mat depth8(height, width, CV_8UC1, &(depthData_[0]));
+
 	cv::normalize(depth, depthO, 0, 255.0, cv::NORM_MINMAX);
 	//depth.convertTo(depth8, CV_8UC1, 1.0 / 256.0, 0);
 	depthO.convertTo(depth8, CV_8UC1, 1.0, 0);
@@ -74,11 +88,6 @@ void ONIToQtConverter::newDepthFrame(int frameIndex, int width, int height, int
 	//qDebug() << depth.type() << ", " << depth.rows << ", " << depth.cols;
 	//qDebug() << depth8.type() << ", " << depth8.rows << ", " << depth8.cols;
 
-	if (depthData_.size() < width * height)
-		depthData_.resize(width * height);
-
-	memcpy(&(depthData_[0]), depth8.ptr<const unsigned char>(0), width * height);
-
 	depthImg_ = QImage(&(depthData_[0]), width, height, width, QImage::Format::Format_Grayscale8);
 	//depthImg_.save("qdepth8.png");
 
@@ -20,10 +20,8 @@ public:
 	virtual void setup(StitcherI* pStitcher);
 	virtual void cleanup();
 
-	virtual void newColorFrame(int frameIndex, int width, int height, int stride, int size, const void* data,
-		const openni::VideoStream* pVS);
-	virtual void newDepthFrame(int frameIndex, int width, int height, int stride, int size, const void* data,
-		const openni::VideoStream* pVS);
+	virtual void newColorFrame(const FrameHandle& frame, const openni::VideoStream* pVS);
+	virtual void newDepthFrame(const FrameHandle& frame, const openni::VideoStream* pVS);
 
 
 	void setLabels(PixmapLabel*pRGBLabel, PixmapLabel*pDepthLabel);
@@ -41,7 +39,7 @@ private:
 
 	std::mutex mutex_;
 	QImage colorImg_, depthImg_;
-	std::vector<unsigned char> colorData_, depthData_;
+	std::vector<unsigned char> depthData_;
 };
 
 #endif
@@ -0,0 +1,332 @@
+#include "RGBDOdometry.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+
+#include <open3d/utility/Eigen.h>
+
+namespace
+{
+	// Same weights as Open3D's RGBDOdometryJacobianFromHybridTerm
+	const double sobelScale = 0.125;
+	const double lambdaHybridDepth = 0.968;
+
+	/**
+	 * Marks depth values outside of [minDepth, maxDepth] as invalid (NaN).
+	 */
+	void preprocessDepth(open3d::geometry::Image &depth, double minDepth, double maxDepth)
+	{
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+		float *pDepth = depth.PointerAt<float>(0, 0);
+		const size_t numPixels = static_cast<size_t>(depth.width_) * depth.height_;
+		for(size_t i = 0; i < numPixels; i++)
+		{
+			const float d = pDepth[i];
+			if(d < minDepth || d > maxDepth || d <= 0)
+				pDepth[i] = nan;
+		}
+	}
+
+	/**
+	 * Scales the intensity so that its mean over pixels with valid depth is 0.5.
+	 */
+	void normalizeIntensity(open3d::geometry::Image &intensity, const open3d::geometry::Image &depth)
+	{
+		float *pIntensity = intensity.PointerAt<float>(0, 0);
+		const float *pDepth = depth.PointerAt<float>(0, 0);
+		const size_t numPixels = static_cast<size_t>(intensity.width_) * intensity.height_;
+
+		double sum = 0;
+		size_t count = 0;
+		for(size_t i = 0; i < numPixels; i++)
+		{
+			if(!std::isnan(pDepth[i]))
+			{
+				sum += pIntensity[i];
+				count++;
+			}
+		}
+		if(count == 0 || sum <= 0)
+			return;
+
+		const float scale = static_cast<float>(0.5 * static_cast<double>(count) / sum);
+		for(size_t i = 0; i < numPixels; i++)
+			pIntensity[i] *= scale;
+	}
+
+	void convertDepthToXYZ(const open3d::geometry::Image &depth, const Eigen::Matrix3d &intrinsicMatrix,
+		open3d::geometry::Image &xyz)
+	{
+		const double invFx = 1.0 / intrinsicMatrix(0, 0), invFy = 1.0 / intrinsicMatrix(1, 1);
+		const double cx = intrinsicMatrix(0, 2), cy = intrinsicMatrix(1, 2);
+
+		xyz.Prepare(depth.width_, depth.height_, 3, 4);
+		for(int y = 0; y < depth.height_; y++)
+		{
+			const float *pDepth = depth.PointerAt<float>(0, y);
+			float *pXYZ = xyz.PointerAt<float>(0, y, 0);
+			for(int x = 0; x < depth.width_; x++, pXYZ += 3)
+			{
+				const float z = pDepth[x];
+				pXYZ[0] = static_cast<float>((x - cx) * z * invFx);
+				pXYZ[1] = static_cast<float>((y - cy) * z * invFy);
+				pXYZ[2] = z;
+			}
+		}
+	}
+}
+
+OdometryFrame::OdometryFrame(const open3d::geometry::RGBDImage &rgbdImage,
+	const open3d::camera::PinholeCameraIntrinsic &intrinsic,
+	const open3d::pipelines::odometry::OdometryOption &option)
+{
+	open3d::geometry::Image depth = rgbdImage.depth_;
+	preprocessDepth(depth, option.min_depth_, option.max_depth_);
+
+	// Smoothed like in Open3D's InitializeRGBDOdometry, the gradients are too noisy otherwise
+	auto intensity = rgbdImage.color_.CreateFloatImage()->Filter(open3d::geometry::Image::FilterType::Gaussian3);
+	auto smoothedDepth = depth.Filter(open3d::geometry::Image::FilterType::Gaussian3);
+	normalizeIntensity(*intensity, *smoothedDepth);
+
+	const size_t numLevels = option.iteration_number_per_pyramid_level_.size();
+	open3d::geometry::RGBDImage packed(*intensity, *smoothedDepth);
+	pyramid_ = packed.CreatePyramid(numLevels);
+	pyramidDx_ = open3d::geometry::RGBDImage::FilterPyramid(pyramid_, open3d::geometry::Image::FilterType::Sobel3Dx);
+	pyramidDy_ = open3d::geometry::RGBDImage::FilterPyramid(pyramid_, open3d::geometry::Image::FilterType::Sobel3Dy);
+
+	xyz_.resize(pyramid_.size());
+	intrinsicMatrices_.resize(pyramid_.size());
+	for(size_t level = 0; level < pyramid_.size(); level++)
+	{
+		const double levelScale = 1.0 / static_cast<double>(1 << level);
+		intrinsicMatrices_[level] = intrinsic.intrinsic_matrix_ * levelScale;
+		intrinsicMatrices_[level](2, 2) = 1.0;
+
+		convertDepthToXYZ(pyramid_[level]->depth_, intrinsicMatrices_[level], xyz_[level]);
+	}
+}
+
+std::tuple<bool, Eigen::Matrix4d, Eigen::Matrix6d> RGBDOdometry::compute(
+	const OdometryFrame &source, const OdometryFrame &target,
+	const Eigen::Matrix4d &odoInit,
+	const open3d::pipelines::odometry::OdometryOption &option)
+{
+	const auto startTime = std::chrono::steady_clock::now();
+	const size_t numLevels = std::min(option.iteration_number_per_pyramid_level_.size(),
+		std::min(source.getNumberOfLevels(), target.getNumberOfLevels()));
+
+	statistics_.iterations.assign(numLevels, 0);
+	statistics_.totalIterations = 0;
+
+	bool isSuccess = true;
+	Eigen::Matrix4d extrinsic = odoInit;
+	for(int level = static_cast<int>(numLevels) - 1; level >= 0 && isSuccess; level--)
+	{
+		const size_t levelIndex = numLevels - level - 1;
+		const int numIterations = option.iteration_number_per_pyramid_level_[levelIndex];
+		for(int iteration = 0; iteration < numIterations; iteration++)
+		{
+			Eigen::Matrix4d delta;
+			std::tie(isSuccess, delta) = doSingleIteration(source, target, level, extrinsic, option);
+			statistics_.iterations[levelIndex]++;
+			statistics_.totalIterations++;
+			if(!isSuccess)
+				break;
+
+			extrinsic = delta * extrinsic;
+			if(isConverged(delta))
+				break;
+		}
+	}
+
+	Eigen::Matrix6d information = Eigen::Matrix6d::Identity();
+	if(isSuccess)
+		information = computeInformationMatrix(source, target, extrinsic, option);
+	else
+		extrinsic = Eigen::Matrix4d::Identity();
+
+	statistics_.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	return std::make_tuple(isSuccess, extrinsic, information);
+}
+
+bool RGBDOdometry::isConverged(const Eigen::Matrix4d &delta) const
+{
+	const double translation = delta.block<3, 1>(0, 3).norm();
+	// Rotation angle from the trace, clamped against rounding errors
+	const double cosAngle = std::min(1.0, std::max(-1.0, 0.5 * (delta.block<3, 3>(0, 0).trace() - 1.0)));
+	const double rotation = std::acos(cosAngle);
+	return translation < convergenceTranslation_ && rotation < convergenceRotation_;
+}
+
+/**
+ * Projects the valid source pixels into the target image.
+ *
+ * If several source pixels hit the same target pixel, the closest one is kept.
+ */
+void RGBDOdometry::computeCorrespondences(const Eigen::Matrix3d &intrinsicMatrix, const Eigen::Matrix4d &extrinsic,
+	const open3d::geometry::Image &sourceDepth, const open3d::geometry::Image &targetDepth,
+	double maxDepthDiff)
+{
+	const Eigen::Matrix3d R = extrinsic.block<3, 3>(0, 0);
+	const Eigen::Matrix3d KRKInv = intrinsicMatrix * R * intrinsicMatrix.inverse();
+	const Eigen::Vector3d Kt = intrinsicMatrix * extrinsic.block<3, 1>(0, 3);
+
+	const int width = targetDepth.width_, height = targetDepth.height_;
+	correspondenceMap_.assign(static_cast<size_t>(width) * height, -1);
+	depthBuffer_.assign(static_cast<size_t>(width) * height, std::numeric_limits<float>::infinity());
+
+	for(int vs = 0; vs < sourceDepth.height_; vs++)
+	{
+		const float *pSourceDepth = sourceDepth.PointerAt<float>(0, vs);
+		for(int us = 0; us < sourceDepth.width_; us++)
+		{
+			const float ds = pSourceDepth[us];
+			if(std::isnan(ds))
+				continue;
+
+			const Eigen::Vector3d uvInTarget = ds * KRKInv * Eigen::Vector3d(us, vs, 1.0) + Kt;
+			const double transformedDs = uvInTarget(2);
+			const int ut = static_cast<int>(uvInTarget(0) / transformedDs + 0.5);
+			const int vt = static_cast<int>(uvInTarget(1) / transformedDs + 0.5);
+			if(ut < 0 || ut >= width || vt < 0 || vt >= height)
+				continue;
+
+			const float dt = *targetDepth.PointerAt<float>(ut, vt);
+			if(std::isnan(dt) || std::abs(transformedDs - dt) > maxDepthDiff)
+				continue;
+
+			const size_t index = static_cast<size_t>(vt) * width + ut;
+			if(transformedDs < depthBuffer_[index])
+			{
+				depthBuffer_[index] = static_cast<float>(transformedDs);
+				correspondenceMap_[index] = vs * sourceDepth.width_ + us;
+			}
+		}
+	}
+
+	correspondences_.clear();
+	for(int vt = 0; vt < height; vt++)
+	{
+		for(int ut = 0; ut < width; ut++)
+		{
+			const int sourceIndex = correspondenceMap_[static_cast<size_t>(vt) * width + ut];
+			if(sourceIndex >= 0)
+				correspondences_.push_back(Eigen::Vector4i(sourceIndex % sourceDepth.width_, sourceIndex / sourceDepth.width_, ut, vt));
+		}
+	}
+}
+
+std::tuple<bool, Eigen::Matrix4d> RGBDOdometry::doSingleIteration(
+	const OdometryFrame &source, const OdometryFrame &target, size_t level,
+	const Eigen::Matrix4d &extrinsic, const open3d::pipelines::odometry::OdometryOption &option)
+{
+	const Eigen::Matrix3d &intrinsicMatrix = target.getIntrinsicMatrix(level);
+	const open3d::geometry::RGBDImage &sourceImage = source.getImage(level);
+	const open3d::geometry::RGBDImage &targetImage = target.getImage(level);
+	const open3d::geometry::RGBDImage &targetDx = target.getDx(level);
+	const open3d::geometry::RGBDImage &targetDy = target.getDy(level);
+	const open3d::geometry::Image &sourceXYZ = source.getXYZ(level);
+
+	computeCorrespondences(intrinsicMatrix, extrinsic, sourceImage.depth_, targetImage.depth_, option.max_depth_diff_);
+	if(correspondences_.empty())
+		return std::make_tuple(false, Eigen::Matrix4d::Identity().eval());
+
+	const double sqrtLambdaDepth = std::sqrt(lambdaHybridDepth);
+	const double sqrtLambdaImage = std::sqrt(1.0 - lambdaHybridDepth);
+	const double fx = intrinsicMatrix(0, 0), fy = intrinsicMatrix(1, 1);
+	const Eigen::Matrix3d R = extrinsic.block<3, 3>(0, 0);
+	const Eigen::Vector3d t = extrinsic.block<3, 1>(0, 3);
+
+	Eigen::Matrix6d JTJ = Eigen::Matrix6d::Zero();
+	Eigen::Vector6d JTr = Eigen::Vector6d::Zero();
+	const int numCorrespondences = static_cast<int>(correspondences_.size());
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		Eigen::Matrix6d JTJPrivate = Eigen::Matrix6d::Zero();
+		Eigen::Vector6d JTrPrivate = Eigen::Vector6d::Zero();
+		Eigen::Vector6d J;
+
+#ifdef _OPENMP
+#pragma omp for nowait
+#endif
+		for(int row = 0; row < numCorrespondences; row++)
+		{
+			const int us = correspondences_[row](0), vs = correspondences_[row](1);
+			const int ut = correspondences_[row](2), vt = correspondences_[row](3);
+
+			const double diffPhoto = *targetImage.color_.PointerAt<float>(ut, vt) - *sourceImage.color_.PointerAt<float>(us, vs);
+			const double dIdx = sobelScale * *targetDx.color_.PointerAt<float>(ut, vt);
+			const double dIdy = sobelScale * *targetDy.color_.PointerAt<float>(ut, vt);
+			double dDdx = sobelScale * *targetDx.depth_.PointerAt<float>(ut, vt);
+			double dDdy = sobelScale * *targetDy.depth_.PointerAt<float>(ut, vt);
+			if(std::isnan(dDdx))
+				dDdx = 0;
+			if(std::isnan(dDdy))
+				dDdy = 0;
+
+			const float *pXYZ = sourceXYZ.PointerAt<float>(us, vs, 0);
+			const Eigen::Vector3d p = R * Eigen::Vector3d(pXYZ[0], pXYZ[1], pXYZ[2]) + t;
+			const double diffGeo = *targetImage.depth_.PointerAt<float>(ut, vt) - p(2);
+
+			const double invZ = 1.0 / p(2);
+			const double c0 = dIdx * fx * invZ;
+			const double c1 = dIdy * fy * invZ;
+			const double c2 = -(c0 * p(0) + c1 * p(1)) * invZ;
+			const double d0 = dDdx * fx * invZ;
+			const double d1 = dDdy * fy * invZ;
+			const double d2 = -(d0 * p(0) + d1 * p(1)) * invZ;
+
+			// Photometric term
+			J << -p(2) * c1 + p(1) * c2, p(2) * c0 - p(0) * c2, -p(1) * c0 + p(0) * c1, c0, c1, c2;
+			J *= sqrtLambdaImage;
+			JTJPrivate.noalias() += J * J.transpose();
+			JTrPrivate.noalias() += J * (sqrtLambdaImage * diffPhoto);
+
+			// Geometric term
+			J << (-p(2) * d1 + p(1) * d2) - p(1), (p(2) * d0 - p(0) * d2) + p(0), -p(1) * d0 + p(0) * d1, d0, d1, d2 - 1.0;
+			J *= sqrtLambdaDepth;
+			JTJPrivate.noalias() += J * J.transpose();
+			JTrPrivate.noalias() += J * (sqrtLambdaDepth * diffGeo);
+		}
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+		{
+			JTJ += JTJPrivate;
+			JTr += JTrPrivate;
+		}
+	}
+
+	return open3d::utility::SolveJacobianSystemAndObtainExtrinsicMatrix(JTJ, JTr);
+}
+
+Eigen::Matrix6d RGBDOdometry::computeInformationMatrix(
+	const OdometryFrame &source, const OdometryFrame &target,
+	const Eigen::Matrix4d &extrinsic, const open3d::pipelines::odometry::OdometryOption &option)
+{
+	computeCorrespondences(target.getIntrinsicMatrix(0), extrinsic,
+		source.getImage(0).depth_, target.getImage(0).depth_, option.max_depth_diff_);
+
+	const open3d::geometry::Image &targetXYZ = target.getXYZ(0);
+	Eigen::Matrix6d GTG = Eigen::Matrix6d::Zero();
+	Eigen::Vector6d G;
+	for(const auto &correspondence : correspondences_)
+	{
+		const float *pXYZ = targetXYZ.PointerAt<float>(correspondence(2), correspondence(3), 0);
+		const double x = pXYZ[0], y = pXYZ[1], z = pXYZ[2];
+
+		G << 0, z, -y, 1, 0, 0;
+		GTG.noalias() += G * G.transpose();
+		G << -z, 0, x, 0, 1, 0;
+		GTG.noalias() += G * G.transpose();
+		G << y, -x, 0, 0, 0, 1;
+		GTG.noalias() += G * G.transpose();
+	}
+	return GTG;
+}
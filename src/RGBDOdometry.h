@@ -0,0 +1,129 @@
+#ifndef RGBDODOMETRY_H
+#define RGBDODOMETRY_H
+
+#include "open3d/Open3D.h"
+
+#include <vector>
+#include <tuple>
+
+#include <Eigen/StdVector>
+
+/**
+ * Per-frame odometry state: image pyramids, gradients and vertex maps.
+ *
+ * Open3D's ComputeRGBDOdometry rebuilds all of this for both images on every
+ * call, although each frame is used twice in a row (once as target, then as
+ * source). An OdometryFrame is built once per frame and reused for both.
+ */
+class OdometryFrame
+{
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	OdometryFrame(const open3d::geometry::RGBDImage &rgbdImage,
+		const open3d::camera::PinholeCameraIntrinsic &intrinsic,
+		const open3d::pipelines::odometry::OdometryOption &option);
+
+	size_t getNumberOfLevels() const { return pyramid_.size(); }
+
+	/**
+	 * Intensity (float, normalized to a mean of 0.5) and depth (float, NaN if invalid).
+	 */
+	const open3d::geometry::RGBDImage &getImage(size_t level) const { return *pyramid_[level]; }
+	const open3d::geometry::RGBDImage &getDx(size_t level) const { return *pyramidDx_[level]; }
+	const open3d::geometry::RGBDImage &getDy(size_t level) const { return *pyramidDy_[level]; }
+
+	/**
+	 * Back-projected depth, three float channels.
+	 */
+	const open3d::geometry::Image &getXYZ(size_t level) const { return xyz_[level]; }
+
+	const Eigen::Matrix3d &getIntrinsicMatrix(size_t level) const { return intrinsicMatrices_[level]; }
+
+private:
+	open3d::geometry::RGBDImagePyramid pyramid_, pyramidDx_, pyramidDy_;
+	std::vector<open3d::geometry::Image> xyz_;
+	std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d> > intrinsicMatrices_;
+};
+
+/**
+ * What one RGBDOdometry::compute() call cost.
+ */
+struct OdometryStatistics
+{
+	std::vector<int> iterations;	//!< Gauss-Newton iterations per pyramid level, coarsest first
+	int totalIterations{ 0 };
+	double milliseconds{ 0 };
+};
+
+/**
+ * Multi-scale RGBD odometry with the hybrid (photometric and geometric) term.
+ *
+ * Follows Open3D's ComputeRGBDOdometry with RGBDOdometryJacobianFromHybridTerm,
+ * but works on precomputed OdometryFrames. One difference: the intensities are
+ * normalized per frame instead of per image pair, which is what allows the
+ * frames to be reused.
+ *
+ * The iterations per pyramid level in the OdometryOption are an upper bound:
+ * a level is left as soon as the pose update falls below the convergence
+ * threshold, so frames with little motion take only a few iterations.
+ */
+class RGBDOdometry
+{
+public:
+	RGBDOdometry() { }
+
+	/**
+	 * Estimates the transformation from the source to the target camera.
+	 *
+	 * Returns success, the transformation and the information matrix,
+	 * like open3d::pipelines::odometry::ComputeRGBDOdometry.
+	 */
+	std::tuple<bool, Eigen::Matrix4d, Eigen::Matrix6d> compute(
+		const OdometryFrame &source, const OdometryFrame &target,
+		const Eigen::Matrix4d &odoInit,
+		const open3d::pipelines::odometry::OdometryOption &option);
+
+	/**
+	 * A pyramid level is considered converged once an update translates by less
+	 * than translation (in metres) and rotates by less than rotation (in radians).
+	 * Zero for both always runs the full number of iterations.
+	 */
+	void setConvergenceThreshold(double translation, double rotation)
+	{
+		convergenceTranslation_ = translation;
+		convergenceRotation_ = rotation;
+	}
+
+	/**
+	 * Iterations and time of the last compute() call.
+	 */
+	const OdometryStatistics &getLastStatistics() const { return statistics_; }
+
+private:
+	typedef std::vector<Eigen::Vector4i, Eigen::aligned_allocator<Eigen::Vector4i> > Correspondences;
+
+	void computeCorrespondences(const Eigen::Matrix3d &intrinsicMatrix, const Eigen::Matrix4d &extrinsic,
+		const open3d::geometry::Image &sourceDepth, const open3d::geometry::Image &targetDepth,
+		double maxDepthDiff);
+
+	std::tuple<bool, Eigen::Matrix4d> doSingleIteration(
+		const OdometryFrame &source, const OdometryFrame &target, size_t level,
+		const Eigen::Matrix4d &extrinsic, const open3d::pipelines::odometry::OdometryOption &option);
+
+	Eigen::Matrix6d computeInformationMatrix(
+		const OdometryFrame &source, const OdometryFrame &target,
+		const Eigen::Matrix4d &extrinsic, const open3d::pipelines::odometry::OdometryOption &option);
+
+	bool isConverged(const Eigen::Matrix4d &delta) const;
+
+	double convergenceTranslation_{ 1e-4 }, convergenceRotation_{ 1e-4 };
+	OdometryStatistics statistics_;
+
+	// Scratch buffers, reused between calls
+	Correspondences correspondences_;
+	std::vector<int> correspondenceMap_;
+	std::vector<float> depthBuffer_;
+};
+
+#endif
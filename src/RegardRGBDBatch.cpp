@@ -0,0 +1,307 @@
+#include "Stitcher.h"
+#include "ScanReplay.h"
+#include "Trace.h"
+
+#include <Eigen/Core>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+/**
+ * Command line options of the batch reconstruction.
+ */
+struct BatchOptions
+{
+	std::string input;
+	std::string journalInput;
+	std::string journalOutput;	// Derived from the input and the optimized mesh if empty
+	std::string onlineMeshFile{ "mesh_online.ply" };
+	std::string optimizedMeshFile{ "mesh_opt.ply" };
+	std::string colorMeshFile{ "mesh_color_opt.ply" };
+	std::string traceFile;
+	double voxelLength{ 4.0 / 512 };
+	double optimizedVoxelLength{ 2.0 / 512 };
+	double depthScale{ 5000.0 };
+	size_t memoryLimit{ static_cast<size_t>(2048) * 1024 * 1024 };
+	int saveStages{ Stitcher::SAVE_ALL };
+	bool realTime{ false };
+	bool frameToFrame{ false };
+	bool overwriteJournal{ false };
+	std::vector<double> intrinsics;
+};
+
+static void printUsage(const char *program)
+{
+	std::cout << "Usage: " << program << " [options] <recording.oni | TUM sequence directory>\n"
+		<< "       " << program << " [options] --load-journal <journal>\n"
+		<< "\n"
+		<< "Reconstructs a recorded scan without a display.\n"
+		<< "\n"
+		<< "Options:\n"
+		<< "  --voxel <m>               Voxel size of the online volume (default 0.0078125)\n"
+		<< "  --opt-voxel <m>           Voxel size of the optimized volume (default 0.00390625)\n"
+		<< "  --stages <list>           Comma separated results to write: online, opt, color (default all)\n"
+		<< "  --online-mesh <file>      Online mesh (default mesh_online.ply)\n"
+		<< "  --opt-mesh <file>         Optimized mesh (default mesh_opt.ply)\n"
+		<< "  --color-mesh <file>       Color optimized mesh (default mesh_color_opt.ply)\n"
+		<< "  --journal <file>          Frame journal written during the scan (default <input name>_journal.bin\n"
+		<< "                            next to the optimized mesh)\n"
+		<< "  --overwrite-journal       Replace an existing journal instead of stopping\n"
+		<< "  --load-journal <file>     Only rerun the optimization on a recorded journal\n"
+		<< "  --memory-limit <MB>       Frames kept in memory before spilling to the journal (default 2048)\n"
+		<< "  --depth-scale <n>         Depth values per metre of a TUM sequence (default 5000)\n"
+		<< "  --intrinsics <w,h,fx,fy,cx,cy>  Depth camera intrinsics\n"
+		<< "  --frame-to-frame          Track against the previous frame instead of the model\n"
+		<< "  --realtime                Replay at the recorded frame rate instead of full speed\n"
+		<< "  --trace <file>            Write a Chrome trace of all threads\n"
+		<< "  --help                    Show this text" << std::endl;
+}
+
+static bool parseStages(const std::string &value, int &stages)
+{
+	stages = 0;
+	std::istringstream stream(value);
+	std::string stage;
+	while(std::getline(stream, stage, ','))
+	{
+		if(stage == "online")
+			stages |= Stitcher::SAVE_ONLINE_MESH;
+		else if(stage == "opt")
+			stages |= Stitcher::SAVE_OPTIMIZED_MESH;
+		else if(stage == "color")
+			stages |= Stitcher::SAVE_COLOR_MESH;
+		else if(stage == "all")
+			stages |= Stitcher::SAVE_ALL;
+		else
+			return false;
+	}
+	return true;
+}
+
+static bool parseNumbers(const std::string &value, std::vector<double> &numbers)
+{
+	numbers.clear();
+	std::istringstream stream(value);
+	std::string number;
+	while(std::getline(stream, number, ','))
+	{
+		char *end = nullptr;
+		numbers.push_back(std::strtod(number.c_str(), &end));
+		if(end == number.c_str() || *end != '\0')
+			return false;
+	}
+	return true;
+}
+
+static bool parseArguments(int argc, char **argv, BatchOptions &options)
+{
+	for(int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = (i + 1 < argc);
+
+		if(arg == "--help" || arg == "-h")
+			return false;
+		else if(arg == "--realtime")
+			options.realTime = true;
+		else if(arg == "--frame-to-frame")
+			options.frameToFrame = true;
+		else if(arg == "--overwrite-journal")
+			options.overwriteJournal = true;
+		else if(arg.compare(0, 2, "--") == 0 && !hasValue)
+		{
+			std::cerr << "Missing value for " << arg << std::endl;
+			return false;
+		}
+		else if(arg == "--voxel")
+			options.voxelLength = std::atof(argv[++i]);
+		else if(arg == "--opt-voxel")
+			options.optimizedVoxelLength = std::atof(argv[++i]);
+		else if(arg == "--stages")
+		{
+			if(!parseStages(argv[++i], options.saveStages))
+			{
+				std::cerr << "Unknown stage in " << argv[i] << std::endl;
+				return false;
+			}
+		}
+		else if(arg == "--online-mesh")
+			options.onlineMeshFile = argv[++i];
+		else if(arg == "--opt-mesh")
+			options.optimizedMeshFile = argv[++i];
+		else if(arg == "--color-mesh")
+			options.colorMeshFile = argv[++i];
+		else if(arg == "--journal")
+			options.journalOutput = argv[++i];
+		else if(arg == "--trace")
+			options.traceFile = argv[++i];
+		else if(arg == "--load-journal")
+			options.journalInput = argv[++i];
+		else if(arg == "--memory-limit")
+			options.memoryLimit = static_cast<size_t>(std::atof(argv[++i]) * 1024 * 1024);
+		else if(arg == "--depth-scale")
+			options.depthScale = std::atof(argv[++i]);
+		else if(arg == "--intrinsics")
+		{
+			if(!parseNumbers(argv[++i], options.intrinsics) || options.intrinsics.size() != 6)
+			{
+				std::cerr << "Expected w,h,fx,fy,cx,cy for --intrinsics" << std::endl;
+				return false;
+			}
+		}
+		else if(arg.compare(0, 1, "-") == 0)
+		{
+			std::cerr << "Unknown option " << arg << std::endl;
+			return false;
+		}
+		else
+			options.input = arg;
+	}
+
+	if(options.voxelLength <= 0 || options.optimizedVoxelLength <= 0 || options.depthScale <= 0)
+	{
+		std::cerr << "Voxel sizes and depth scale must be positive" << std::endl;
+		return false;
+	}
+	return !options.input.empty() || !options.journalInput.empty();
+}
+
+/**
+ * The directory part of a path including the trailing separator, empty if there is none.
+ */
+static std::string getDirectory(const std::string &path)
+{
+	const size_t separator = path.find_last_of("/\\");
+	return (separator == std::string::npos) ? std::string() : path.substr(0, separator + 1);
+}
+
+/**
+ * The last component of a path without its extension, e.g. "scan" for "/data/scan.oni" or "/data/scan/".
+ */
+static std::string getBaseName(std::string path)
+{
+	while(path.size() > 1 && (path.back() == '/' || path.back() == '\\'))
+		path.pop_back();
+	const size_t separator = path.find_last_of("/\\");
+	if(separator != std::string::npos)
+		path = path.substr(separator + 1);
+	const size_t extension = path.find_last_of('.');
+	if(extension != std::string::npos && extension > 0)
+		path = path.substr(0, extension);
+	return path.empty() ? std::string("scan") : path;
+}
+
+static bool fileExists(const std::string &filename)
+{
+	return std::ifstream(filename).good();
+}
+
+int main(int argc, char** argv)
+{
+	Eigen::initParallel();
+
+	BatchOptions options;
+	if(!parseArguments(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	// Parallel runs must not share a journal, it is read back while it is written
+	if(options.journalInput.empty())
+	{
+		if(options.journalOutput.empty())
+			options.journalOutput = getDirectory(options.optimizedMeshFile) + getBaseName(options.input) + "_journal.bin";
+		if(!options.overwriteJournal && fileExists(options.journalOutput))
+		{
+			std::cerr << "The journal " << options.journalOutput << " exists, choose another one with --journal"
+				<< " or pass --overwrite-journal" << std::endl;
+			return 1;
+		}
+	}
+
+	if(!options.traceFile.empty())
+	{
+		Trace::setThreadName("main");
+		Trace::setEnabled(true);
+	}
+
+	int returnValue = 0;
+	try
+	{
+		Stitcher stitcher;
+		stitcher.setVoxelLength(options.voxelLength, options.optimizedVoxelLength);
+		stitcher.setOutputFiles(options.onlineMeshFile, options.optimizedMeshFile, options.colorMeshFile);
+		stitcher.setFrameMemoryLimit(options.memoryLimit);
+		stitcher.setJournalFile(options.journalOutput);
+		if(options.intrinsics.size() == 6)
+		{
+			stitcher.setIntrinsic(open3d::camera::PinholeCameraIntrinsic(
+				static_cast<int>(options.intrinsics[0]), static_cast<int>(options.intrinsics[1]),
+				options.intrinsics[2], options.intrinsics[3], options.intrinsics[4], options.intrinsics[5]));
+		}
+		// No frame may be dropped
+		stitcher.setBackpressureMode(Stitcher::BACKPRESSURE_BLOCK);
+		if(options.frameToFrame)
+			stitcher.setTrackingMode(Stitcher::TRACKING_FRAME_TO_FRAME);
+
+		if(!options.journalInput.empty())
+		{
+			// A journal has no online volume
+			stitcher.setSaveStages(options.saveStages & ~Stitcher::SAVE_ONLINE_MESH);
+			if(!stitcher.loadJournal(options.journalInput))
+			{
+				std::cerr << "Could not load " << options.journalInput << std::endl;
+				return 1;
+			}
+		}
+		else
+		{
+			stitcher.setSaveStages(options.saveStages);
+			stitcher.setup();
+
+			ScanReplay replay(stitcher);
+			replay.setRealTime(options.realTime);
+			replay.setDepthScale(options.depthScale);
+			if(options.intrinsics.size() == 6)
+				replay.setDepthIntrinsics(options.intrinsics[2], options.intrinsics[3], options.intrinsics[4], options.intrinsics[5]);
+			if(!replay.run(options.input))
+				return 1;
+
+			// At full speed every frame waits for the converter, so a dropped frame is an error
+			if(replay.getDroppedFrames() > 0)
+			{
+				std::cerr << "The converter dropped " << replay.getDroppedFrames() << " frames" << std::endl;
+				if(!options.realTime)
+					returnValue = 1;
+			}
+		}
+
+		stitcher.saveVolume();
+
+		if(stitcher.isJournalFailed())
+		{
+			std::cerr << "The frame journal of the scan is incomplete" << std::endl;
+			returnValue = 1;
+		}
+	}
+	catch (std::exception & e)
+	{
+		std::cerr << "Exception occurred: " << e.what() << std::endl;
+		returnValue = 2;
+	}
+	catch (...)
+	{
+		std::cerr << "Unknown exception occurred" << std::endl;
+		returnValue = 2;
+	}
+
+	if(!options.traceFile.empty() && !Trace::writeChromeTrace(options.traceFile))
+		std::cerr << "Could not write " << options.traceFile << std::endl;
+
+	return returnValue;
+}
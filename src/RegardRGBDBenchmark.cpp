@@ -0,0 +1,392 @@
+#include "Stitcher.h"
+#include "ScanReplay.h"
+#include "LatencyRecorder.h"
+#include "FrameJournal.h"
+#include "RGBDOdometry.h"
+
+#include <Eigen/Core>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+/**
+ * Command line options of the benchmark.
+ */
+struct BenchmarkOptions
+{
+	std::string dataset;
+	std::string outputFile{ "benchmark.json" };
+	std::string outputDirectory{ "." };
+	double voxelLength{ 4.0 / 512 };
+	double optimizedVoxelLength{ 2.0 / 512 };
+	double depthScale{ 5000.0 };
+	std::vector<int> odometryIterations{ 20, 10, 5 };
+	std::vector<double> intrinsics;
+	int runs{ 1 };
+	bool frameToFrame{ false };
+	int validatePairs{ 0 };
+	int meshInterval{ 0 };
+};
+
+/**
+ * How RGBDOdometry compares with Open3D's ComputeRGBDOdometry on the same frame pairs.
+ */
+struct OdometryValidation
+{
+	int pairs{ 0 };
+	int agreeing{ 0 };	//!< Both succeeded or both failed
+	int bothSucceeded{ 0 };
+	double meanTranslation{ 0 }, maxTranslation{ 0 };	//!< Difference of the results in metres, where both succeeded
+	double meanRotation{ 0 }, maxRotation{ 0 };	//!< In radians
+};
+
+static void printUsage(const char *program)
+{
+	std::cout << "Usage: " << program << " [options] <recording.oni | TUM sequence directory>\n"
+		<< "\n"
+		<< "Replays a recording at full speed, runs the whole reconstruction and reports\n"
+		<< "the latency of each stage (p50/p95/p99) and the peak memory use as JSON.\n"
+		<< "\n"
+		<< "Options:\n"
+		<< "  --output <file>           JSON report (default benchmark.json)\n"
+		<< "  --output-dir <dir>        Directory for the meshes and the journal (default .)\n"
+		<< "  --runs <n>                Number of runs, the samples of all runs are combined (default 1)\n"
+		<< "  --voxel <m>               Voxel size of the online volume (default 0.0078125)\n"
+		<< "  --opt-voxel <m>           Voxel size of the optimized volume (default 0.00390625)\n"
+		<< "  --iterations <list>       Odometry iterations per pyramid level, coarsest first (default 20,10,5)\n"
+		<< "  --depth-scale <n>         Depth values per metre of a TUM sequence (default 5000)\n"
+		<< "  --intrinsics <w,h,fx,fy,cx,cy>  Depth camera intrinsics\n"
+		<< "  --frame-to-frame          Track against the previous frame instead of the model\n"
+		<< "  --mesh-interval <n>       Extract an online mesh every n integrated frames (default 0, none)\n"
+		<< "  --validate-odometry <n>   Compare the odometry with Open3D's on the first n frame pairs of the journal\n"
+		<< "  --help                    Show this text" << std::endl;
+}
+
+template<typename T>
+static bool parseList(const std::string &value, std::vector<T> &numbers)
+{
+	numbers.clear();
+	std::istringstream stream(value);
+	std::string number;
+	while(std::getline(stream, number, ','))
+	{
+		std::istringstream numberStream(number);
+		T parsed;
+		if(!(numberStream >> parsed) || !numberStream.eof())
+			return false;
+		numbers.push_back(parsed);
+	}
+	return !numbers.empty();
+}
+
+static bool parseArguments(int argc, char **argv, BenchmarkOptions &options)
+{
+	for(int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = (i + 1 < argc);
+
+		if(arg == "--help" || arg == "-h")
+			return false;
+		else if(arg == "--frame-to-frame")
+			options.frameToFrame = true;
+		else if(arg.compare(0, 2, "--") == 0 && !hasValue)
+		{
+			std::cerr << "Missing value for " << arg << std::endl;
+			return false;
+		}
+		else if(arg == "--output")
+			options.outputFile = argv[++i];
+		else if(arg == "--output-dir")
+			options.outputDirectory = argv[++i];
+		else if(arg == "--runs")
+			options.runs = std::atoi(argv[++i]);
+		else if(arg == "--validate-odometry")
+			options.validatePairs = std::atoi(argv[++i]);
+		else if(arg == "--mesh-interval")
+			options.meshInterval = std::atoi(argv[++i]);
+		else if(arg == "--voxel")
+			options.voxelLength = std::atof(argv[++i]);
+		else if(arg == "--opt-voxel")
+			options.optimizedVoxelLength = std::atof(argv[++i]);
+		else if(arg == "--depth-scale")
+			options.depthScale = std::atof(argv[++i]);
+		else if(arg == "--iterations")
+		{
+			if(!parseList(argv[++i], options.odometryIterations))
+			{
+				std::cerr << "Expected a comma separated list for --iterations" << std::endl;
+				return false;
+			}
+		}
+		else if(arg == "--intrinsics")
+		{
+			if(!parseList(argv[++i], options.intrinsics) || options.intrinsics.size() != 6)
+			{
+				std::cerr << "Expected w,h,fx,fy,cx,cy for --intrinsics" << std::endl;
+				return false;
+			}
+		}
+		else if(arg.compare(0, 1, "-") == 0)
+		{
+			std::cerr << "Unknown option " << arg << std::endl;
+			return false;
+		}
+		else
+			options.dataset = arg;
+	}
+
+	if(options.voxelLength <= 0 || options.optimizedVoxelLength <= 0 || options.depthScale <= 0 || options.runs < 1 ||
+		options.validatePairs < 0 || options.meshInterval < 0)
+	{
+		std::cerr << "Voxel sizes, depth scale and runs must be positive, validated pairs and mesh interval not negative" << std::endl;
+		return false;
+	}
+	return !options.dataset.empty();
+}
+
+static std::string escapeJSON(const std::string &value)
+{
+	std::string escaped;
+	for(char c : value)
+	{
+		if(c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+/**
+ * One complete reconstruction, the stage latencies go to the recorder.
+ */
+static bool runBenchmark(const BenchmarkOptions &options, const std::shared_ptr<LatencyRecorder> &recorder,
+	int &replayedFrames, int &processedFrames)
+{
+	const std::string prefix = options.outputDirectory + "/benchmark_";
+
+	Stitcher stitcher;
+	stitcher.setVoxelLength(options.voxelLength, options.optimizedVoxelLength);
+	stitcher.setOdometryIterations(options.odometryIterations);
+	stitcher.setOutputFiles(prefix + "online.ply", prefix + "opt.ply", prefix + "color_opt.ply");
+	stitcher.setJournalFile(prefix + "journal.bin");
+	if(options.intrinsics.size() == 6)
+	{
+		stitcher.setIntrinsic(open3d::camera::PinholeCameraIntrinsic(
+			static_cast<int>(options.intrinsics[0]), static_cast<int>(options.intrinsics[1]),
+			options.intrinsics[2], options.intrinsics[3], options.intrinsics[4], options.intrinsics[5]));
+	}
+	stitcher.setMeshInterval(options.meshInterval);
+	// No frame is dropped, so runs are comparable
+	stitcher.setBackpressureMode(Stitcher::BACKPRESSURE_BLOCK);
+	if(options.frameToFrame)
+		stitcher.setTrackingMode(Stitcher::TRACKING_FRAME_TO_FRAME);
+	stitcher.setLatencyRecorder(recorder);
+	stitcher.setup();
+
+	ScanReplay replay(stitcher);
+	replay.setDepthScale(options.depthScale);
+	if(options.intrinsics.size() == 6)
+		replay.setDepthIntrinsics(options.intrinsics[2], options.intrinsics[3], options.intrinsics[4], options.intrinsics[5]);
+	replay.setLatencyRecorder(recorder);
+	if(!replay.run(options.dataset))
+		return false;
+	if(replay.getDroppedFrames() > 0)
+	{
+		// Runs are only comparable if every frame reached the stitcher
+		std::cerr << "The converter dropped " << replay.getDroppedFrames() << " frames" << std::endl;
+		return false;
+	}
+
+	stitcher.saveVolume();
+	if(stitcher.isJournalFailed())
+	{
+		// The odometry validation reads the journal
+		std::cerr << "The frame journal of the scan is incomplete" << std::endl;
+		return false;
+	}
+
+	replayedFrames = replay.getReplayedFrames();
+	processedFrames = stitcher.getProcessedFrames();
+	return true;
+}
+
+static open3d::camera::PinholeCameraIntrinsic getIntrinsic(const BenchmarkOptions &options)
+{
+	if(options.intrinsics.size() == 6)
+	{
+		return open3d::camera::PinholeCameraIntrinsic(
+			static_cast<int>(options.intrinsics[0]), static_cast<int>(options.intrinsics[1]),
+			options.intrinsics[2], options.intrinsics[3], options.intrinsics[4], options.intrinsics[5]);
+	}
+	return Stitcher().getIntrinsic();
+}
+
+/**
+ * Registers consecutive frames of the journal written by the last run with
+ * RGBDOdometry and with open3d::pipelines::odometry::ComputeRGBDOdometry,
+ * both from identity and with the Stitcher's options.
+ *
+ * The early convergence test is disabled, so both run the same iterations;
+ * the remaining differences come from the per-frame intensity normalization.
+ */
+static bool validateOdometry(const BenchmarkOptions &options, OdometryValidation &validation)
+{
+	const std::string journalFile = options.outputDirectory + "/benchmark_journal.bin";
+	FrameJournalReader journal;
+	if(!journal.open(journalFile))
+		return false;
+
+	const open3d::camera::PinholeCameraIntrinsic intrinsic = journal.hasIntrinsic() ? journal.getIntrinsic() : getIntrinsic(options);
+	const open3d::pipelines::odometry::OdometryOption option(options.odometryIterations, 0.2);
+	RGBDOdometry odometry;
+	odometry.setConvergenceThreshold(0, 0);
+
+	const size_t numPairs = std::min(static_cast<size_t>(options.validatePairs), journal.size() > 0 ? journal.size() - 1 : 0);
+	std::shared_ptr<JournalFrame> source = journal.readFrame(0);
+	for(size_t i = 0; i < numPairs; i++)
+	{
+		std::shared_ptr<JournalFrame> target = journal.readFrame(i + 1);
+		if(!source || !target)
+		{
+			std::cerr << "Could not read frame " << (source ? i + 1 : i) << " from " << journalFile << std::endl;
+			return false;
+		}
+
+		const OdometryFrame sourceFrame(*source->image, intrinsic, option), targetFrame(*target->image, intrinsic, option);
+		const auto result = odometry.compute(sourceFrame, targetFrame, Eigen::Matrix4d::Identity(), option);
+
+		// Open3D expects the intensity as float
+		const open3d::geometry::RGBDImage sourceImage(*source->image->color_.CreateFloatImage(), source->image->depth_);
+		const open3d::geometry::RGBDImage targetImage(*target->image->color_.CreateFloatImage(), target->image->depth_);
+		const auto reference = open3d::pipelines::odometry::ComputeRGBDOdometry(sourceImage, targetImage, intrinsic,
+			Eigen::Matrix4d::Identity(), open3d::pipelines::odometry::RGBDOdometryJacobianFromHybridTerm(), option);
+
+		validation.pairs++;
+		if(std::get<0>(result) == std::get<0>(reference))
+			validation.agreeing++;
+		if(std::get<0>(result) && std::get<0>(reference))
+		{
+			const Eigen::Matrix4d difference = std::get<1>(result) * std::get<1>(reference).inverse();
+			const double translation = difference.block<3, 1>(0, 3).norm();
+			const double cosAngle = std::min(1.0, std::max(-1.0, 0.5 * (difference.block<3, 3>(0, 0).trace() - 1.0)));
+			const double rotation = std::acos(cosAngle);
+
+			validation.bothSucceeded++;
+			validation.meanTranslation += translation;
+			validation.meanRotation += rotation;
+			validation.maxTranslation = std::max(validation.maxTranslation, translation);
+			validation.maxRotation = std::max(validation.maxRotation, rotation);
+		}
+		source = target;
+	}
+	if(validation.bothSucceeded > 0)
+	{
+		validation.meanTranslation /= validation.bothSucceeded;
+		validation.meanRotation /= validation.bothSucceeded;
+	}
+
+	std::cout << "Odometry validation: " << validation.agreeing << " of " << validation.pairs << " pairs agree on success"
+		<< ", translation difference mean " << validation.meanTranslation << " m, max " << validation.maxTranslation << " m"
+		<< ", rotation difference mean " << validation.meanRotation << " rad, max " << validation.maxRotation << " rad" << std::endl;
+	return true;
+}
+
+static void writeReport(std::ostream &out, const BenchmarkOptions &options, LatencyRecorder &recorder,
+	int replayedFrames, int processedFrames, double seconds, const OdometryValidation *validation)
+{
+	out << "{\n"
+		<< "\t\"dataset\": \"" << escapeJSON(options.dataset) << "\",\n"
+		<< "\t\"parameters\": {\n"
+		<< "\t\t\"voxel_length\": " << options.voxelLength << ",\n"
+		<< "\t\t\"optimized_voxel_length\": " << options.optimizedVoxelLength << ",\n"
+		<< "\t\t\"odometry_iterations\": [";
+	for(size_t i = 0; i < options.odometryIterations.size(); i++)
+		out << (i > 0 ? ", " : "") << options.odometryIterations[i];
+	out << "],\n"
+		<< "\t\t\"tracking\": \"" << (options.frameToFrame ? "frame_to_frame" : "frame_to_model") << "\",\n"
+		<< "\t\t\"mesh_interval\": " << options.meshInterval << ",\n"
+		<< "\t\t\"runs\": " << options.runs << "\n"
+		<< "\t},\n"
+		<< "\t\"frames_per_run\": " << replayedFrames << ",\n"
+		<< "\t\"processed_frames_per_run\": " << processedFrames << ",\n"
+		<< "\t\"seconds_per_run\": " << seconds / options.runs << ",\n"
+		<< "\t\"peak_rss_bytes\": " << LatencyRecorder::getPeakResidentSetSize() << ",\n";
+	if(validation)
+	{
+		out << "\t\"odometry_validation\": {\n"
+			<< "\t\t\"pairs\": " << validation->pairs << ",\n"
+			<< "\t\t\"agreeing\": " << validation->agreeing << ",\n"
+			<< "\t\t\"both_succeeded\": " << validation->bothSucceeded << ",\n"
+			<< "\t\t\"translation_mean\": " << validation->meanTranslation << ",\n"
+			<< "\t\t\"translation_max\": " << validation->maxTranslation << ",\n"
+			<< "\t\t\"rotation_mean\": " << validation->meanRotation << ",\n"
+			<< "\t\t\"rotation_max\": " << validation->maxRotation << "\n"
+			<< "\t},\n";
+	}
+	out << "\t\"stages\": ";
+	recorder.writeJSON(out, "\t");
+	out << "\n}" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	Eigen::initParallel();
+
+	BenchmarkOptions options;
+	if(!parseArguments(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	int returnValue = 0;
+	try
+	{
+		auto recorder = std::make_shared<LatencyRecorder>();
+		int replayedFrames = 0, processedFrames = 0;
+
+		const auto startTime = std::chrono::steady_clock::now();
+		for(int run = 0; run < options.runs; run++)
+		{
+			if(!runBenchmark(options, recorder, replayedFrames, processedFrames))
+				return 1;
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+		OdometryValidation validation;
+		if(options.validatePairs > 0 && !validateOdometry(options, validation))
+			return 1;
+
+		// Not to stdout, the stages print their progress there
+		std::ofstream file(options.outputFile);
+		writeReport(file, options, *recorder, replayedFrames, processedFrames, seconds,
+			options.validatePairs > 0 ? &validation : nullptr);
+		if(!file)
+		{
+			std::cerr << "Could not write " << options.outputFile << std::endl;
+			return 1;
+		}
+		std::cout << "Benchmark report written to " << options.outputFile << std::endl;
+	}
+	catch (std::exception & e)
+	{
+		std::cerr << "Exception occurred: " << e.what() << std::endl;
+		returnValue = 2;
+	}
+	catch (...)
+	{
+		std::cerr << "Unknown exception occurred" << std::endl;
+		returnValue = 2;
+	}
+
+	return returnValue;
+}
@@ -16,6 +16,7 @@
 #include "ONI3DConverter.h"
 #include "ScanImageTo3D.h"
 #include "utilities/Conversions.h"
+#include "Trace.h"
 
 // Qt
 #include <QFileDialog>
@@ -62,6 +63,8 @@ RegardRGBDMainWindow::RegardRGBDMainWindow()
 	connect(actionAbout, &QAction::triggered, this, &RegardRGBDMainWindow::slotAbout);
 	connect(actionConnect_with_OpenNI, &QAction::triggered, this, &RegardRGBDMainWindow::slotConnectOpenNI);
 	connect(actionDisconnect, &QAction::triggered, this, &RegardRGBDMainWindow::slotDisconnectOpenNI);
+	connect(actionRecordTrace, &QAction::toggled, this, &RegardRGBDMainWindow::slotRecordTrace);
+	connect(actionSaveTrace, &QAction::triggered, this, &RegardRGBDMainWindow::slotSaveTrace);
 
 	QObject::connect(this, &RegardRGBDMainWindow::scan3DMeshChanged,
 		this, &RegardRGBDMainWindow::slotScan3DMeshChanged, Qt::ConnectionType::QueuedConnection);
@@ -196,6 +199,35 @@ void RegardRGBDMainWindow::slotDisconnectOpenNI()
 	}
 }
 
+/**
+ * Starts or stops recording trace events, the events recorded before are kept.
+ */
+void RegardRGBDMainWindow::slotRecordTrace(bool checked)
+{
+	if (checked)
+		Trace::setThreadName("GUI");
+	Trace::setEnabled(checked);
+}
+
+/**
+ * Writes the recorded trace events, to be opened in chrome://tracing or Perfetto.
+ */
+void RegardRGBDMainWindow::slotSaveTrace()
+{
+	QString filename = QFileDialog::getSaveFileName(this, tr("Save Trace"),
+		QStringLiteral("trace.json"), tr("Chrome trace (*.json)"));
+	if (filename.isEmpty())
+		return;
+
+	if (!Trace::writeChromeTrace(filename.toStdString()))
+	{
+		QMessageBox msgBox(this);
+		msgBox.setIcon(QMessageBox::Icon::Critical);
+		msgBox.setText(tr("Could not write the trace"));
+		msgBox.exec();
+	}
+}
+
 /**
  * This method emits the scan3DMeshChanged signal.
  *
@@ -216,6 +248,7 @@ void RegardRGBDMainWindow::update3DScanMesh()
  */
 void RegardRGBDMainWindow::slotScan3DMeshChanged()
 {
+	TRACE_SCOPE("RegardRGBDMainWindow::slotScan3DMeshChanged");
 	if (pScanImageTo3D_)
 	{
 		isDrawingScan3DMesh_ = true;
@@ -228,8 +261,16 @@ void RegardRGBDMainWindow::slotScan3DMeshChanged()
 		//auto aa = Conversions::convertOpen3DToOSG(mesh);
 
 		const auto pc = pScanImageTo3D_->getPointCloud();
-		auto aa = Conversions::convertOpen3DToOSG(pc);
-
-		bottomLeftOpenGLWidget->setGeometry(aa);
+		if (!scan3DPointCloud_)
+		{
+			scan3DPointCloud_ = Conversions::createDynamicPointCloud();
+			Conversions::updateDynamicPointCloud(scan3DPointCloud_.get(), pc);
+			bottomLeftOpenGLWidget->setGeometry(scan3DPointCloud_);
+		}
+		else
+		{
+			Conversions::updateDynamicPointCloud(scan3DPointCloud_.get(), pc);
+			bottomLeftOpenGLWidget->update();
+		}
 	}
 }
@@ -17,6 +17,9 @@ class ONI3DConverter;
 #include <memory>
 #include <atomic>
 
+// OpenSceneGraph
+#include <osg/Group>
+
 // Qt
 #include <QMainWindow>
 
@@ -40,6 +43,8 @@ public slots:
 	virtual void slotOneShotTimer();
 	virtual void slotConnectOpenNI();
 	virtual void slotDisconnectOpenNI();
+	virtual void slotRecordTrace(bool checked);
+	virtual void slotSaveTrace();
 
 	virtual void slotScan3DMeshChanged();
 
@@ -58,6 +63,9 @@ private:
 	std::unique_ptr<ONI3DConverter> pONI3DConverter_;
 
 	std::atomic<bool> isDrawingScan3DMesh_{ false };
+
+	// Live point cloud, created once and updated in place
+	osg::ref_ptr<osg::Group> scan3DPointCloud_;
 };
 
 #endif
@@ -0,0 +1,281 @@
+#include "ReplayDevice.h"
+
+#include "ConverterInterface.h"
+#include "FrameHandle.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+ReplayDevice::ReplayDevice()
+	: framePool_(FramePool::create())
+{
+}
+
+ReplayDevice::~ReplayDevice()
+{
+	close();
+}
+
+bool ReplayDevice::open(const std::string &path, ReplayMode mode)
+{
+	close();
+
+	mode_ = mode;
+	const std::string extension(".oni");
+	if(path.size() > extension.size()
+		&& path.compare(path.size() - extension.size(), extension.size(), extension) == 0)
+	{
+		isRecording_ = oniDevice_.connectRecording(path, mode == REPLAY_REALTIME);
+		return isRecording_;
+	}
+	return openSequence(path);
+}
+
+void ReplayDevice::close()
+{
+	stop();
+
+	if(isRecording_)
+	{
+		oniDevice_.pause();
+		oniDevice_.disconnectDevice();
+		isRecording_ = false;
+	}
+	frames_.clear();
+	converters_.clear();
+	replayedFrames_ = 0;
+	isRecordingReplayed_ = false;
+}
+
+void ReplayDevice::setConverter(ConverterInterface *pConverter)
+{
+	// Recordings deliver the frames through OpenNI, the list is still
+	// needed to hold back the next frame in fast mode
+	if(isRecording_)
+		oniDevice_.setConverter(pConverter);
+	converters_.push_back(pConverter);
+}
+
+bool ReplayDevice::start()
+{
+	if(isRecording_ && mode_ == REPLAY_REALTIME)
+		return oniDevice_.resume();
+
+	if((!isRecording_ && frames_.empty()) || replayThread_.joinable())
+		return false;
+
+	terminate_ = false;
+	replayedFrames_ = 0;
+	if(isRecording_)
+	{
+		if(!oniDevice_.resume())
+			return false;
+		isRecordingReplayed_ = false;
+		replayThread_ = std::thread(&ReplayDevice::recordingEntry, this);
+	}
+	else
+	{
+		replayThread_ = std::thread(&ReplayDevice::replayEntry, this);
+	}
+	return true;
+}
+
+void ReplayDevice::stop()
+{
+	terminate_ = true;
+	if(replayThread_.joinable())
+		replayThread_.join();
+
+	if(isRecording_)
+		oniDevice_.pause();
+}
+
+bool ReplayDevice::isFinished() const
+{
+	if(isRecording_ && mode_ == REPLAY_FAST)
+		return isRecordingReplayed_;
+	if(isRecording_)
+		return oniDevice_.isRecordingFinished();
+	return replayedFrames_ >= static_cast<int>(frames_.size());
+}
+
+int ReplayDevice::getNumberOfFrames() const
+{
+	if(isRecording_)
+		return oniDevice_.getNumberOfRecordedFrames();
+	return static_cast<int>(frames_.size());
+}
+
+int ReplayDevice::getReplayedFrames() const
+{
+	if(isRecording_)
+		return oniDevice_.getLastFrameIndex();
+	return replayedFrames_;
+}
+
+/**
+ * Reads the file lists of a TUM sequence and pairs every depth image with
+ * the color image closest in time.
+ */
+bool ReplayDevice::openSequence(const std::string &directory)
+{
+	FileList colorFiles, depthFiles;
+	if(!readFileList(directory + "/rgb.txt", colorFiles)
+		|| !readFileList(directory + "/depth.txt", depthFiles))
+	{
+		std::cerr << "ReplayDevice: No rgb.txt/depth.txt in " << directory << std::endl;
+		return false;
+	}
+
+	std::sort(colorFiles.begin(), colorFiles.end());
+	std::sort(depthFiles.begin(), depthFiles.end());
+
+	directory_ = directory;
+	for(const auto &depthFile : depthFiles)
+	{
+		auto it = std::lower_bound(colorFiles.begin(), colorFiles.end(), depthFile,
+			[](const FileList::value_type &a, const FileList::value_type &b) { return a.first < b.first; });
+
+		// Closest of the neighbours in time
+		auto best = colorFiles.end();
+		if(it != colorFiles.end())
+			best = it;
+		if(it != colorFiles.begin()
+			&& (best == colorFiles.end() || depthFile.first - (it - 1)->first < best->first - depthFile.first))
+			best = it - 1;
+
+		if(best == colorFiles.end() || std::abs(best->first - depthFile.first) > maxTimeDifference_)
+			continue;
+
+		SequenceFrame frame;
+		frame.timestamp = depthFile.first;
+		frame.colorFile = best->second;
+		frame.depthFile = depthFile.second;
+		frames_.push_back(frame);
+	}
+
+	std::cout << "ReplayDevice: " << frames_.size() << " frame pairs of "
+		<< depthFiles.size() << " depth and " << colorFiles.size() << " color images" << std::endl;
+	return !frames_.empty();
+}
+
+/**
+ * Reads "timestamp filename" lines, lines starting with # are comments.
+ */
+bool ReplayDevice::readFileList(const std::string &filename, FileList &files)
+{
+	std::ifstream file(filename);
+	if(!file)
+		return false;
+
+	std::string line;
+	while(std::getline(file, line))
+	{
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream lineStream(line);
+		double timestamp;
+		std::string path;
+		if(lineStream >> timestamp >> path)
+			files.push_back(std::make_pair(timestamp, path));
+	}
+	return true;
+}
+
+void ReplayDevice::replayEntry()
+{
+	const auto startTime = std::chrono::steady_clock::now();
+	const double firstTimestamp = frames_.front().timestamp;
+
+	for(size_t i = 0; i < frames_.size() && !terminate_; i++)
+	{
+		const SequenceFrame &frame = frames_[i];
+
+		if(mode_ == REPLAY_REALTIME)
+		{
+			const auto offset = std::chrono::microseconds(static_cast<int64_t>((frame.timestamp - firstTimestamp) * 1e6));
+			std::this_thread::sleep_until(startTime + offset);
+		}
+		else
+		{
+			waitForConverters();
+		}
+
+		if(!terminate_ && !replayFrame(frame, static_cast<int>(i) + 1))
+			std::cerr << "ReplayDevice: Could not read " << frame.colorFile << " / " << frame.depthFile << std::endl;
+		replayedFrames_++;
+	}
+}
+
+/**
+ * Steps an .oni recording in fast mode. Like sequences, every frame waits
+ * until the converters have taken the previous one, so none are dropped.
+ */
+void ReplayDevice::recordingEntry()
+{
+	const int numberOfFrames = oniDevice_.getNumberOfRecordedFrames();
+	for(int i = 0; i < numberOfFrames && !terminate_; i++)
+	{
+		waitForConverters();
+		if(terminate_)
+			break;
+
+		if(!oniDevice_.readRecordedFrame())
+		{
+			std::cerr << "ReplayDevice: Could not read frame " << i + 1 << " of the recording" << std::endl;
+			break;
+		}
+		replayedFrames_++;
+	}
+	isRecordingReplayed_ = true;
+}
+
+/**
+ * Loads one frame pair and hands it to the converters like a sensor frame:
+ * RGB888 color and 16 bit depth in millimetres, both with the depth image's
+ * timestamp (in microseconds since the start of the sequence).
+ */
+bool ReplayDevice::replayFrame(const SequenceFrame &frame, int frameIndex)
+{
+	cv::Mat color = cv::imread(directory_ + "/" + frame.colorFile, cv::IMREAD_COLOR);
+	cv::Mat depth = cv::imread(directory_ + "/" + frame.depthFile, cv::IMREAD_ANYDEPTH);
+	if(color.empty() || depth.empty() || depth.type() != CV_16UC1)
+		return false;
+
+	cv::cvtColor(color, color, cv::COLOR_BGR2RGB);
+	if(depthScale_ != 1000.0)
+		depth.convertTo(depth, CV_16UC1, 1000.0 / depthScale_);
+
+	const uint64_t timestamp = static_cast<uint64_t>(std::llround((frame.timestamp - frames_.front().timestamp) * 1e6));
+	FrameHandle colorHandle = FrameHandle::fromPool(*framePool_, frameIndex, timestamp,
+		color.cols, color.rows, static_cast<int>(color.step[0]),
+		static_cast<int>(color.step[0] * color.rows), color.data);
+	FrameHandle depthHandle = FrameHandle::fromPool(*framePool_, frameIndex, timestamp,
+		depth.cols, depth.rows, static_cast<int>(depth.step[0]),
+		static_cast<int>(depth.step[0] * depth.rows), depth.data);
+
+	for(auto pConverter : converters_)
+	{
+		pConverter->newColorFrame(colorHandle, nullptr);
+		pConverter->newDepthFrame(depthHandle, nullptr);
+	}
+	return true;
+}
+
+void ReplayDevice::waitForConverters()
+{
+	for(auto pConverter : converters_)
+	{
+		while(pConverter->isBacklogged() && !terminate_)
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+}
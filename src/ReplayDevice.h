@@ -0,0 +1,109 @@
+#ifndef REPLAYDEVICE_H
+#define REPLAYDEVICE_H
+
+#include "ONIDevice.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+class ConverterInterface;
+class FramePool;
+
+/**
+ * Feeds recorded scans into the converters instead of a live sensor.
+ *
+ * Two kinds of recordings are supported:
+ * - .oni files, played back by OpenNI through the regular ONIListener path.
+ *   In fast mode the recording is stepped manually by the replay thread.
+ * - Image sequences in the layout of the TUM RGB-D benchmark: a directory
+ *   with rgb.txt and depth.txt, each listing "timestamp filename" per line,
+ *   8 bit color PNGs and 16 bit depth PNGs. Color and depth images are paired
+ *   by their timestamps. These frames reach the converters with a nullptr
+ *   video stream, so the depth intrinsics have to be set on the converter
+ *   (see ONI3DConverter::setDepthIntrinsics()).
+ *
+ * In real-time mode, frames are delivered at the recorded rate. In fast mode
+ * they are delivered as fast as the converters accept them, which makes the
+ * replay deterministic and suitable for benchmarks.
+ */
+class ReplayDevice
+{
+public:
+	enum ReplayMode
+	{
+		REPLAY_FAST,		//!< As fast as the converters accept frames
+		REPLAY_REALTIME		//!< At the recorded frame rate
+	};
+
+	ReplayDevice();
+	~ReplayDevice();
+
+	/**
+	 * Opens an .oni file or a TUM sequence directory.
+	 *
+	 * OpenNI has to be initialized for .oni files.
+	 */
+	bool open(const std::string &path, ReplayMode mode);
+	void close();
+
+	void setConverter(ConverterInterface *pConverter);
+
+	/**
+	 * Depth image values per metre of a sequence, 5000 for TUM. The depth is
+	 * converted to millimetres, like the sensor's.
+	 */
+	void setDepthScale(double depthScale) { depthScale_ = depthScale; }
+
+	/**
+	 * Maximum time difference (in seconds) between a color and a depth image of a sequence.
+	 */
+	void setMaxTimeDifference(double maxTimeDifference) { maxTimeDifference_ = maxTimeDifference; }
+
+	bool start();
+	void stop();
+
+	/**
+	 * True once all frames have been delivered.
+	 */
+	bool isFinished() const;
+
+	int getNumberOfFrames() const;
+	int getReplayedFrames() const;
+
+private:
+	struct SequenceFrame
+	{
+		double timestamp;
+		std::string colorFile, depthFile;
+	};
+	typedef std::vector<std::pair<double, std::string> > FileList;
+
+	bool openSequence(const std::string &directory);
+	static bool readFileList(const std::string &filename, FileList &files);
+	void replayEntry();
+	void recordingEntry();
+	bool replayFrame(const SequenceFrame &frame, int frameIndex);
+	void waitForConverters();
+
+	ReplayMode mode_{ REPLAY_FAST };
+	bool isRecording_{ false };
+	ONIDevice oniDevice_;
+
+	std::string directory_;
+	std::vector<SequenceFrame> frames_;
+	double depthScale_{ 5000.0 };
+	double maxTimeDifference_{ 0.02 };
+
+	std::vector<ConverterInterface *> converters_;
+	std::shared_ptr<FramePool> framePool_;
+	std::thread replayThread_;
+	std::atomic<bool> terminate_{ false };
+	std::atomic<int> replayedFrames_{ 0 };
+	std::atomic<bool> isRecordingReplayed_{ false };
+};
+
+#endif
@@ -12,7 +12,11 @@
 #include <open3d/pipelines/registration/GlobalOptimization.h>
 #include <open3d/pipelines/color_map/ColorMapOptimization.h>
 
+// Besides the published snapshot and the one the GUI may still draw, no buffer is needed
+static const size_t maxReleasedPointClouds = 2;
+
 ScanImageTo3D::ScanImageTo3D()
+	: pointCloudPool_(std::make_shared<PointCloudPool>())
 {
 }
 
@@ -41,17 +45,50 @@ void ScanImageTo3D::addNewImage(const open3d::geometry::Image& colorImg, const o
 	//open3d::io::WriteImageToPNG("color.png", colorImg_);
 	//open3d::io::WriteImageToPNG("depth.png", depthImg_);
 
-	Eigen::Matrix4d identity = Eigen::Matrix4d::Identity();
-	auto depthFlt = depthImg.ConvertDepthToFloatImage(depthScale_, std::numeric_limits<float>::max());
+	const auto focalLength = intrinsic.GetFocalLength();
+	const auto principalPoint = intrinsic.GetPrincipalPoint();
+	backProjection_.setup(depthImg.width_, depthImg.height_,
+		focalLength.first, focalLength.second,
+		principalPoint.first, principalPoint.second);
 
-	open3d::geometry::RGBDImage source(colorImg, *depthFlt);
+	// Reuse a buffer that no snapshot refers to any more
+	std::unique_ptr<PointCloudSoA> buffer;
+	{
+		std::unique_lock<std::mutex> lock(pointCloudPool_->mutex);
+		if(!pointCloudPool_->released.empty())
+		{
+			buffer = std::move(pointCloudPool_->released.back());
+			pointCloudPool_->released.pop_back();
+		}
+	}
+	if(!buffer)
+		buffer.reset(new PointCloudSoA());
+
+	// Same points as PointCloud::CreateFromRGBDImage, but in float precision with packed
+	// colors, read directly from the 16 bit depth image with the vectorized kernel
+	DepthToPointCloud::convert(depthImg.PointerAt<uint16_t>(0, 0), depthImg.width_,
+		colorImg.PointerAt<uint8_t>(0, 0, 0), colorImg.BytesPerLine(),
+		backProjection_, static_cast<float>(1.0 / depthScale_), *buffer);
+
+	// Whoever drops the last reference hands the buffer back, the pool may already be gone
+	std::weak_ptr<PointCloudPool> pool = pointCloudPool_;
+	std::shared_ptr<const PointCloudSoA> pointCloud(buffer.release(), [pool](const PointCloudSoA *pPointCloud)
+		{
+			std::unique_ptr<PointCloudSoA> released(const_cast<PointCloudSoA *>(pPointCloud));
+			if(auto lockedPool = pool.lock())
+			{
+				std::unique_lock<std::mutex> lock(lockedPool->mutex);
+				if(lockedPool->released.size() < maxReleasedPointClouds)
+					lockedPool->released.push_back(std::move(released));
+			}
+		});
 
-	//volume.Integrate(source, intrinsic, identity);
 	{
 		std::unique_lock<std::mutex> lock(mutex_);
-		//triangleMesh_ = volume.ExtractTriangleMesh();
-		pointCloud_ = open3d::geometry::PointCloud::CreateFromRGBDImage(source, intrinsic);
+		std::swap(pointCloud_, pointCloud);
 	}
+	// The previous snapshot is released here, outside of mutex_
+	pointCloud.reset();
 
 	if(pRegardRGBDMainWindow_ != nullptr)
 		pRegardRGBDMainWindow_->update3DScanMesh();
@@ -68,19 +105,23 @@ void ScanImageTo3D::reset()
 }
 
 /**
- * Makes a copy of the triangle mesh.
+ * Returns the current triangle mesh without copying it, or nullptr if there is none.
+ *
+ * The mesh is never modified, a new frame replaces it with a new one.
  */
-const std::shared_ptr<open3d::geometry::TriangleMesh> ScanImageTo3D::getTriangleMesh()
+std::shared_ptr<const open3d::geometry::TriangleMesh> ScanImageTo3D::getTriangleMesh()
 {
 	std::unique_lock<std::mutex> lock(mutex_);
-	return std::make_shared<open3d::geometry::TriangleMesh>(*triangleMesh_);
+	return triangleMesh_;
 }
 
 /**
- * Makes a copy of the point cloud.
+ * Returns the current point cloud without copying it, or nullptr if there is none.
+ *
+ * The point cloud is never modified, a new frame replaces it with a new one.
  */
-const std::shared_ptr<open3d::geometry::PointCloud> ScanImageTo3D::getPointCloud()
+std::shared_ptr<const PointCloudSoA> ScanImageTo3D::getPointCloud()
 {
 	std::unique_lock<std::mutex> lock(mutex_);
-	return std::make_shared<open3d::geometry::PointCloud>(*pointCloud_);
+	return pointCloud_;
 }
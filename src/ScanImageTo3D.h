@@ -4,6 +4,8 @@
 class RegardRGBDMainWindow;
 
 #include "StitcherI.h"
+#include "BackProjectionTable.h"
+#include "DepthToPointCloud.h"
 
 #include "open3d/Open3D.h"
 
@@ -32,8 +34,8 @@ public:
 
 	virtual void setDepthScale(double depthScale) { depthScale_ = depthScale; }
 
-	const std::shared_ptr<open3d::geometry::TriangleMesh> getTriangleMesh();
-	const std::shared_ptr<open3d::geometry::PointCloud> getPointCloud();
+	std::shared_ptr<const open3d::geometry::TriangleMesh> getTriangleMesh();
+	std::shared_ptr<const PointCloudSoA> getPointCloud();
 
 	void setMainFrame(RegardRGBDMainWindow* pRegardRGBDMainWindow) { pRegardRGBDMainWindow_ = pRegardRGBDMainWindow; }
 
@@ -42,8 +44,25 @@ private:
 
 	double depthScale_{ 1000.0 };
 
-	std::shared_ptr<open3d::geometry::TriangleMesh> triangleMesh_;
-	std::shared_ptr<open3d::geometry::PointCloud> pointCloud_;
+	/**
+	 * Point clouds whose last snapshot reference was dropped, for reuse by the next frame.
+	 *
+	 * Buffers only come back through this mutex, after every reader is done with them.
+	 */
+	struct PointCloudPool
+	{
+		std::mutex mutex;
+		std::vector<std::unique_ptr<PointCloudSoA> > released;
+	};
+
+	// Immutable snapshots, replaced as a whole for every new frame.
+	// mutex_ only guards swapping the pointers, readers keep a reference.
+	std::shared_ptr<const open3d::geometry::TriangleMesh> triangleMesh_;
+	std::shared_ptr<const PointCloudSoA> pointCloud_;
+
+	// Only accessed by the thread calling addNewImage()
+	BackProjectionTable backProjection_;
+	std::shared_ptr<PointCloudPool> pointCloudPool_;
 
 	RegardRGBDMainWindow* pRegardRGBDMainWindow_;
 };
@@ -0,0 +1,73 @@
+#include "ScanReplay.h"
+
+#include "Stitcher.h"
+#include "ONI3DConverter.h"
+#include "ReplayDevice.h"
+#include "ONIDevice.h"
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+
+ScanReplay::ScanReplay(Stitcher &stitcher)
+	: stitcher_(stitcher)
+{
+}
+
+bool ScanReplay::run(const std::string &input)
+{
+	replayedFrames_ = 0;
+	droppedFrames_ = 0;
+
+	const bool isONI = (input.size() > 4
+		&& input.compare(input.size() - 4, 4, ".oni") == 0);
+	if(isONI && !ONIDevice::initializeOpenNI())
+	{
+		std::cerr << "Could not initialize OpenNI: " << ONIDevice::getLastErrorString() << std::endl;
+		return false;
+	}
+
+	ONI3DConverter converter;
+	if(intrinsics_.size() == 4)
+		converter.setDepthIntrinsics(intrinsics_[0], intrinsics_[1], intrinsics_[2], intrinsics_[3]);
+	converter.setLatencyRecorder(latencyRecorder_);
+	converter.setup(&stitcher_);
+
+	bool isOK = false;
+	{
+		ReplayDevice replay;
+		replay.setDepthScale(depthScale_);
+		if(replay.open(input, realTime_ ? ReplayDevice::REPLAY_REALTIME : ReplayDevice::REPLAY_FAST))
+		{
+			replay.setConverter(&converter);
+			isOK = replay.start();
+		}
+		else
+		{
+			std::cerr << "Could not open " << input << std::endl;
+		}
+
+		// The converter is drained once it is not backlogged after the last frame
+		auto lastReport = std::chrono::steady_clock::now();
+		while(isOK && (!replay.isFinished() || converter.isBacklogged()))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+			auto now = std::chrono::steady_clock::now();
+			if(now - lastReport > std::chrono::seconds(5))
+			{
+				std::cout << "Replayed " << replay.getReplayedFrames() << " of "
+					<< replay.getNumberOfFrames() << " frames" << std::endl;
+				lastReport = now;
+			}
+		}
+		replayedFrames_ = replay.getReplayedFrames();
+		replay.close();
+	}
+	converter.cleanup();
+	droppedFrames_ = converter.getDroppedFrames();
+
+	if(isONI)
+		ONIDevice::shutdownOpenNI();
+	return isOK;
+}
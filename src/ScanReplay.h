@@ -0,0 +1,55 @@
+#ifndef SCANREPLAY_H
+#define SCANREPLAY_H
+
+#include "LatencyRecorder.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+
+class Stitcher;
+
+/**
+ * Runs a recorded scan through the converter into a stitcher, for the tools
+ * without a GUI. The stitcher has to be set up before.
+ */
+class ScanReplay
+{
+public:
+	explicit ScanReplay(Stitcher &stitcher);
+
+	void setRealTime(bool realTime) { realTime_ = realTime; }
+	/**
+	 * Depth values per metre of image sequences, see ReplayDevice::setDepthScale().
+	 */
+	void setDepthScale(double depthScale) { depthScale_ = depthScale; }
+	/**
+	 * Depth intrinsics of image sequences, see ONI3DConverter::setDepthIntrinsics().
+	 */
+	void setDepthIntrinsics(double fx, double fy, double cx, double cy) { intrinsics_ = { fx, fy, cx, cy }; }
+	void setLatencyRecorder(const std::shared_ptr<LatencyRecorder> &latencyRecorder) { latencyRecorder_ = latencyRecorder; }
+
+	/**
+	 * Replays an .oni file or a TUM sequence directory and returns once every
+	 * frame has been handed to the stitcher.
+	 */
+	bool run(const std::string &input);
+
+	int getReplayedFrames() const { return replayedFrames_; }
+	/**
+	 * Frames the converter dropped during the last run(). Should be 0 unless
+	 * replaying in real time.
+	 */
+	int getDroppedFrames() const { return droppedFrames_; }
+
+private:
+	Stitcher &stitcher_;
+	bool realTime_{ false };
+	double depthScale_{ 5000.0 };
+	std::vector<double> intrinsics_;
+	std::shared_ptr<LatencyRecorder> latencyRecorder_;
+	int replayedFrames_{ 0 };
+	int droppedFrames_{ 0 };
+};
+
+#endif
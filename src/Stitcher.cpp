@@ -1,28 +1,55 @@
 
 #include "Stitcher.h"
+#include "TSDFRaycaster.h"
+#include "TSDFIntegrator.h"
+#include "Trace.h"
 
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <cstdlib>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
 
 #include <Eigen/LU>
 #include <Eigen/Geometry>
 
-#include <open3d/pipelines/registration/GlobalOptimization.h>
 #include <open3d/pipelines/color_map/ColorMapOptimization.h>
 
 Stitcher::Stitcher()
+	: intrinsic_(open3d::camera::PinholeCameraIntrinsicParameters::PrimeSenseDefault),
+	odometryOption_({ 20,10,5 }, 0.2),
+	pos_(Eigen::Matrix4d::Identity()),
+	keyframeGraph_(frameStore_)
 {
+	//intrinsic_.SetIntrinsics(640, 480, 524.0, 524.0, 316.7, 238.5);	// from https://www.researchgate.net/figure/ntrinsic-parameters-of-Kinect-RGB-camera_tbl2_305108995
+	//intrinsic_.SetIntrinsics(640, 480, 517.3, 516.5, 318.6, 255.3);		// from Freiburg test data set
+	//intrinsic_.SetIntrinsics(640, 480, 537.408, 537.40877, 321.897, 236.29);		// from Calibration of my own camera
+	//intrinsic_.SetIntrinsics(640, 480, 533.82, 533.82, 320.55, 232.35);		// from Calibration of my own camera
+	intrinsic_.SetIntrinsics(640, 480, 542.7693, 544.396, 318.79, 239.99);		// from Calibration of my own camera
+	keyframeGraph_.setIntrinsic(intrinsic_);
+	frameStore_.setIntrinsic(intrinsic_);
 }
 
 Stitcher::~Stitcher()
 {
-
+	std::unique_lock<std::mutex> lock(mutex_);
+	stopPipeline(true);
 }
 
+/**
+ * Creates a new volume and starts the pipeline threads.
+ *
+ * Must be called with mutex_ held or before frames are added.
+ */
 void Stitcher::setup()
 {
-	volume_ = std::make_unique<open3d::pipelines::integration::ScalableTSDFVolume>(4.0 / 512, 0.04, open3d::pipelines::integration::TSDFVolumeColorType::RGB8);
+	volume_ = std::make_unique<open3d::pipelines::integration::ScalableTSDFVolume>(onlineVoxelLength_, 0.04, open3d::pipelines::integration::TSDFVolumeColorType::RGB8);
+
+	if(!preprocessQueue_)
+		startPipeline();
 }
 
 bool printRotMatrix(const Eigen::Matrix4d &mat)
@@ -44,103 +71,485 @@ void printRotMatrixQ(const Eigen::Matrix4d& mat)
 }
 
 void Stitcher::addNewImage(const open3d::geometry::Image& colorImg, const open3d::geometry::Image& depthImg)
+{
+	TRACE_SCOPE("Stitcher::addNewImage");
+	std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+	{
+		TRACE_SCOPE("wait Stitcher::mutex_");
+		lock.lock();
+	}
+
+	if(!preprocessQueue_)
+		return;
+
+	if(backpressureMode_ == BACKPRESSURE_KEYFRAME_ONLY && !isKeyframe(depthImg))
+	{
+		skippedFrames_++;
+		return;
+	}
+
+	// The images belong to the caller, so they are copied once on entry
+	PipelineFramePtr frame(new PipelineFrame());
+	frame->colorImg = colorImg;
+	frame->depthImg = depthImg;
+	frame->timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+
+	TRACE_SCOPE("Stitcher queue frame");
+	switch(backpressureMode_)
+	{
+	case BACKPRESSURE_DROP_OLDEST:
+		{
+			size_t numDropped = 0;
+			preprocessQueue_->pushDropOldest(frame, numDropped);
+			droppedFrames_ += static_cast<int>(numDropped);
+		}
+		break;
+	case BACKPRESSURE_DROP_NEWEST:
+		if(!preprocessQueue_->tryPush(frame))
+			droppedFrames_++;
+		break;
+	case BACKPRESSURE_BLOCK:
+	case BACKPRESSURE_KEYFRAME_ONLY:
+	default:
+		preprocessQueue_->push(frame);
+		break;
+	}
+}
+
+/**
+ * Checks whether the depth image differs enough from the last keyframe.
+ *
+ * Only a sparse grid of depth values is compared, so this is cheap enough
+ * to be run on the caller's thread.
+ */
+bool Stitcher::isKeyframe(const open3d::geometry::Image& depthImg)
+{
+	const int step = 8;
+	const int gridWidth = (depthImg.width_ + step - 1) / step;
+	const int gridHeight = (depthImg.height_ + step - 1) / step;
+	const size_t numSamples = static_cast<size_t>(gridWidth) * gridHeight;
+	const int maxDepthChange = static_cast<int>(keyframeDepthChange_ * depthScale_);
+
+	bool isFirst = (keyframeDepth_.size() != numSamples);
+	if(isFirst)
+		keyframeDepth_.assign(numSamples, 0);
+
+	size_t numValid = 0, numChanged = 0;
+	std::vector<uint16_t>::iterator it = keyframeDepth_.begin();
+	for(int y = 0; y < depthImg.height_; y += step)
+	{
+		for(int x = 0; x < depthImg.width_; x += step, ++it)
+		{
+			const int depth = *depthImg.PointerAt<uint16_t>(x, y);
+			const int keyframeDepth = *it;
+			if(depth == 0 && keyframeDepth == 0)
+				continue;
+
+			numValid++;
+			if(depth == 0 || keyframeDepth == 0 || std::abs(depth - keyframeDepth) > maxDepthChange)
+				numChanged++;
+		}
+	}
+
+	if(!isFirst && static_cast<double>(numChanged) <= keyframeMotionFraction_ * static_cast<double>(numValid))
+		return false;
+
+	it = keyframeDepth_.begin();
+	for(int y = 0; y < depthImg.height_; y += step)
+	{
+		for(int x = 0; x < depthImg.width_; x += step, ++it)
+			*it = *depthImg.PointerAt<uint16_t>(x, y);
+	}
+	return true;
+}
+
+int Stitcher::getQueuedFrames()
 {
 	std::unique_lock<std::mutex> lock(mutex_);
+	if(!preprocessQueue_)
+		return 0;
 
-	open3d::camera::PinholeCameraIntrinsic intrinsic = open3d::camera::PinholeCameraIntrinsic(
-		open3d::camera::PinholeCameraIntrinsicParameters::PrimeSenseDefault);
-	//intrinsic.SetIntrinsics(640, 480, 524.0, 524.0, 316.7, 238.5);	// from https://www.researchgate.net/figure/ntrinsic-parameters-of-Kinect-RGB-camera_tbl2_305108995
-	//intrinsic.SetIntrinsics(640, 480, 517.3, 516.5, 318.6, 255.3);		// from Freiburg test data set
-	//intrinsic.SetIntrinsics(640, 480, 537.408, 537.40877, 321.897, 236.29);		// from Calibration of my own camera
-	//intrinsic.SetIntrinsics(640, 480, 533.82, 533.82, 320.55, 232.35);		// from Calibration of my own camera
-	intrinsic.SetIntrinsics(640, 480, 542.7693, 544.396, 318.79, 239.99);		// from Calibration of my own camera
+	return static_cast<int>(preprocessQueue_->size() + odometryQueue_->size() + integrateQueue_->size());
+}
 
-	//open3d::io::WriteImageToPNG("color.png", colorImg_);
-	//open3d::io::WriteImageToPNG("depth.png", depthImg_);
+void Stitcher::printStatistics()
+{
+	std::cout << "Stitcher frames processed: " << processedFrames_
+		<< ", dropped: " << droppedFrames_
+		<< ", skipped: " << skippedFrames_
+		<< ", tracked against model: " << modelTrackedFrames_
+		<< ", retried without motion prior: " << priorRetries_ << std::endl;
+	std::cout << "Stored frames: " << frameStore_.size()
+		<< ", keyframes: " << frameStore_.getKeyframes().size()
+		<< ", spilled to disk: " << frameStore_.getSpilledFrames()
+		<< ", in memory: " << frameStore_.getMemoryUsage() / (1024 * 1024) << " MB" << std::endl;
+
+	std::unique_lock<std::mutex> lock(odometryStatisticsMutex_);
+	int numFrames = 0, totalIterations = 0;
+	double totalMilliseconds = 0;
+	for(const auto &statistics : odometryStatistics_)
+	{
+		if(statistics.iterations.empty())
+			continue;
+		numFrames++;
+		totalIterations += statistics.totalIterations;
+		totalMilliseconds += statistics.milliseconds;
+	}
+	if(numFrames > 0)
+	{
+		std::cout << "Odometry average iterations: " << static_cast<double>(totalIterations) / numFrames
+			<< ", average time: " << totalMilliseconds / numFrames << " ms" << std::endl;
+	}
+}
 
-	Eigen::Matrix4d odo_init = Eigen::Matrix4d::Identity();
-	auto depthFlt = depthImg.ConvertDepthToFloatImage(depthScale_, std::numeric_limits<float>::max());
-	
-	/*{
-		float *ptr = depthFlt->PointerAt<float>(0, 0);
-		int size = depthImg.width_ * depthImg.height_;
-		float maxVal{ std::numeric_limits<float>::lowest() }, minVal{ std::numeric_limits<float>::max() };
-		for (int i = 0; i < size; i++)
+std::vector<OdometryStatistics> Stitcher::getOdometryStatistics()
+{
+	std::unique_lock<std::mutex> lock(odometryStatisticsMutex_);
+	return odometryStatistics_;
+}
+
+/**
+ * Renders the volume at the given pose and prepares it for odometry.
+ *
+ * Returns nullptr if too little of the model is visible, e.g. right after a reset.
+ */
+std::shared_ptr<const OdometryFrame> Stitcher::raycastModel(const Eigen::Matrix4d &pose)
+{
+	LatencyRecorder::Scope scope(latencyRecorder_.get(), "raycast");
+	size_t numPixels;
+	{
+		std::unique_lock<std::mutex> lock(volumeMutex_);
+		numPixels = TSDFRaycaster::raycast(*volume_, intrinsic_, pose,
+			odometryOption_.min_depth_, odometryOption_.max_depth_, modelImage_);
+	}
+
+	const double coverage = static_cast<double>(numPixels) / (static_cast<double>(intrinsic_.width_) * intrinsic_.height_);
+	if(coverage < minModelCoverage_)
+		return nullptr;
+
+	return std::shared_ptr<const OdometryFrame>(new OdometryFrame(modelImage_, intrinsic_, odometryOption_));
+}
+
+void Stitcher::startPipeline()
+{
+	discard_ = false;
+
+	preprocessQueue_ = std::make_unique<BoundedQueue<PipelineFramePtr> >(queueCapacity_);
+	odometryQueue_ = std::make_unique<BoundedQueue<PipelineFramePtr> >(queueCapacity_);
+	integrateQueue_ = std::make_unique<BoundedQueue<PipelineFramePtr> >(queueCapacity_);
+	meshQueue_ = std::make_unique<BoundedQueue<PipelineFramePtr> >(1);
+
+	preprocessThread_ = std::thread(&Stitcher::preprocessEntry, this);
+	odometryThread_ = std::thread(&Stitcher::odometryEntry, this);
+	integrateThread_ = std::thread(&Stitcher::integrateEntry, this);
+	meshThread_ = std::thread(&Stitcher::meshEntry, this);
+
+	if (poseGraphInterval_ > 0)
+	{
+		stopPoseGraph_ = false;
+		poseGraphThread_ = std::thread(&Stitcher::poseGraphEntry, this);
+	}
+}
+
+/**
+ * Stops all stages and joins their threads.
+ *
+ * Each stage closes the queue to the next stage once its input is closed and empty.
+ * If discard is false, all queued frames are processed before this method returns.
+ */
+void Stitcher::stopPipeline(bool discard)
+{
+	if(!preprocessQueue_)
+		return;
+
+	discard_ = discard;
+	preprocessQueue_->close();
+
+	preprocessThread_.join();
+	odometryThread_.join();
+	integrateThread_.join();
+	meshThread_.join();
+
+	// No more keyframes come in, the rest is left to saveVolume()
+	if (poseGraphThread_.joinable())
+	{
 		{
-			const float& val = *ptr;
-			maxVal = std::max(maxVal, val);
-			minVal = std::min(minVal, val);
-			ptr++;
+			std::unique_lock<std::mutex> lock(poseGraphMutex_);
+			stopPoseGraph_ = true;
+			poseGraphCondition_.notify_one();
 		}
+		poseGraphThread_.join();
+	}
 
-		std::cout << "Min: " << minVal << ", max: " << maxVal << std::endl;
-	}*/
+	preprocessQueue_.reset();
+	odometryQueue_.reset();
+	integrateQueue_.reset();
+	meshQueue_.reset();
+}
 
-	open3d::geometry::RGBDImage source(colorImg, *depthFlt);
+/**
+ * Preprocess stage: Converts the depth image to float, builds the RGBD image
+ * and the odometry pyramids.
+ */
+void Stitcher::preprocessEntry()
+{
+	Trace::setThreadName("Stitcher preprocess");
+	PipelineFramePtr frame;
+	while(preprocessQueue_->pop(frame))
+	{
+		if(discard_)
+			continue;
+
+		{
+			LatencyRecorder::Scope scope(latencyRecorder_.get(), "depth_to_float");
+			auto depthFlt = frame->depthImg.ConvertDepthToFloatImage(depthScale_, std::numeric_limits<float>::max());
+			frame->rgbdImage = std::make_shared<open3d::geometry::RGBDImage>(frame->colorImg, *depthFlt);
+		}
+		{
+			LatencyRecorder::Scope scope(latencyRecorder_.get(), "pyramid");
+			frame->odometryFrame.reset(new OdometryFrame(*frame->rgbdImage, intrinsic_, odometryOption_));
+		}
+		frame->colorImg.Clear();
+		frame->depthImg.Clear();
 
-	images_.push_back(source);
+		odometryQueue_->push(frame);
+	}
+	odometryQueue_->close();
+}
 
-	if (!oldRGBDImage_.IsEmpty())
+/**
+ * Odometry stage: Registers each frame against the previous one, or against the
+ * model rendered at the previous pose, and tracks the camera pose.
+ *
+ * Frames whose registration failed are not passed on for integration.
+ */
+void Stitcher::odometryEntry()
+{
+	Trace::setThreadName("Stitcher odometry");
+	PipelineFramePtr frame;
+	while(odometryQueue_->pop(frame))
 	{
-		std::tuple<bool, Eigen::Matrix4d, Eigen::Matrix6d> rgbd_odo =
-			open3d::pipelines::odometry::ComputeRGBDOdometry(
-				oldRGBDImage_, source, intrinsic, odo_init,
-				open3d::pipelines::odometry::RGBDOdometryJacobianFromHybridTerm(),
-				open3d::pipelines::odometry::OdometryOption({ 20,10,5 }, 0.2));
-
-		std::cout << "Matching ";
-		if (std::get<0>(rgbd_odo))
-			std::cout << "successful";
-		else
-			std::cout << "unsuccessful";
-		std::cout << std::endl;
-		//std::cout << " " << std::get<1>(rgbd_odo) << std::endl;
+		if(discard_)
+			continue;
 
-		//bool doIntegrate = printRotMatrix(std::get<1>(rgbd_odo)) && (transvec_.size() < 2);
-		printRotMatrixQ(std::get<1>(rgbd_odo));
+		TRACE_SCOPE("Stitcher odometry frame");
 
-		if (std::get<0>(rgbd_odo))
+		bool doIntegrate = true;
+		if (oldOdometryFrame_)
 		{
-			Eigen::Matrix4d extrinsic = std::get<1>(rgbd_odo);
+			// The model view is rendered at the previous pose, so either way the
+			// result is the motion relative to the previous frame
+			std::shared_ptr<const OdometryFrame> reference;
+			if (trackingMode_ == TRACKING_FRAME_TO_MODEL)
+				reference = raycastModel(pos_);
+			const bool isModelTracked = (reference != nullptr);
+			if (!isModelTracked)
+				reference = oldOdometryFrame_;	// Pyramids are reused, only the new frame was preprocessed
+
+			// Constant velocity: assume the camera moves like it did for the previous frame
+			const bool usePrior = useMotionPrior_ && isVelocityValid_ && !transvec_.empty();
+			Eigen::Matrix4d odo_init = usePrior ? transvec_.back() : Eigen::Matrix4d::Identity();
+			std::tuple<bool, Eigen::Matrix4d, Eigen::Matrix6d> rgbd_odo =
+				odometry_.compute(*reference, *frame->odometryFrame, odo_init, odometryOption_);
+			OdometryStatistics statistics = odometry_.getLastStatistics();
+
+			if (usePrior && !std::get<0>(rgbd_odo))
+			{
+				// The prior can be off after a sudden stop or turn, retry without it
+				odo_init = Eigen::Matrix4d::Identity();
+				rgbd_odo = odometry_.compute(*reference, *frame->odometryFrame, odo_init, odometryOption_);
+
+				const OdometryStatistics &retryStatistics = odometry_.getLastStatistics();
+				for (size_t level = 0; level < statistics.iterations.size() && level < retryStatistics.iterations.size(); level++)
+					statistics.iterations[level] += retryStatistics.iterations[level];
+				statistics.totalIterations += retryStatistics.totalIterations;
+				statistics.milliseconds += retryStatistics.milliseconds;
+				priorRetries_++;
+			}
 
-			//Eigen::Matrix4d extrinsicInv = extrinsic.inverse();
-			transvec_.push_back(extrinsic);
-			infovec_.push_back(std::get<2>(rgbd_odo));
+			if (isModelTracked && std::get<0>(rgbd_odo))
+				modelTrackedFrames_++;
 
-			pos_ = extrinsic * pos_;
-			Eigen::Matrix4d posInv = pos_.inverse();
+			{
+				std::unique_lock<std::mutex> lock(odometryStatisticsMutex_);
+				odometryStatistics_.push_back(statistics);
+			}
+			if (latencyRecorder_)
+				latencyRecorder_->record("odometry", statistics.milliseconds);
+
+			std::cout << (isModelTracked ? "Model matching " : "Matching ");
+			if (std::get<0>(rgbd_odo))
+				std::cout << "successful";
+			else
+				std::cout << "unsuccessful";
+			std::cout << " (" << statistics.totalIterations << " iterations, " << statistics.milliseconds << " ms)" << std::endl;
+
+			printRotMatrixQ(std::get<1>(rgbd_odo));
+
+			doIntegrate = std::get<0>(rgbd_odo);
+			isVelocityValid_ = doIntegrate;
+			if (doIntegrate)
+			{
+				Eigen::Matrix4d extrinsic = std::get<1>(rgbd_odo);
+
+				transvec_.push_back(extrinsic);
+				infovec_.push_back(std::get<2>(rgbd_odo));
 
-			volume_->Integrate(source, intrinsic, pos_);
+				pos_ = extrinsic * pos_;
+			}
+			else
+			{
+				// Keeps the vectors aligned with the stored frames, the pose is unchanged
+				transvec_.push_back(Eigen::Matrix4d::Identity());
+				infovec_.push_back(Eigen::Matrix6d::Identity());
+			}
 		}
+		else
+		{
+			{
+				std::unique_lock<std::mutex> lock(odometryStatisticsMutex_);
+				odometryStatistics_.push_back(OdometryStatistics());
+			}
+			pos_ = Eigen::Matrix4d::Identity();
+			infovec_.push_back(Eigen::Matrix6d::Identity());
+			transvec_.push_back(pos_);
+		}
+
+		posvec_.push_back(pos_);
+		if (frameStore_.add(frame->rgbdImage, frame->timestamp, pos_, transvec_.back(), infovec_.back(), !doIntegrate))
+		{
+			keyframeGraph_.addKeyframe(posvec_.size() - 1, pos_);
+
+			std::unique_lock<std::mutex> lock(poseGraphMutex_);
+			poseGraphCondition_.notify_one();
+		}
+		processedFrames_++;
 
+		oldOdometryFrame_ = frame->odometryFrame;
+		frame->odometryFrame.reset();
+
+		if (doIntegrate)
+		{
+			frame->pose = pos_;
+			integrateQueue_->push(frame);
+		}
 	}
-	else
+	integrateQueue_->close();
+}
+
+/**
+ * Integrate stage: Integrates the frames into the TSDF volume, the volume
+ * units in parallel (see TSDFIntegrator).
+ *
+ * Every meshInterval_ frames a mesh extraction is requested, unless one is still running.
+ */
+void Stitcher::integrateEntry()
+{
+	Trace::setThreadName("Stitcher integrate");
+	int numberOfFrames = 0;
+	PipelineFramePtr frame;
+	while(integrateQueue_->pop(frame))
 	{
-		Eigen::Matrix4d identity = Eigen::Matrix4d::Identity();
-		pos_ = identity;
-		volume_->Integrate(source, intrinsic, identity);
-		infovec_.push_back(Eigen::Matrix6d::Identity());
-		transvec_.push_back(identity);
+		if(discard_)
+			continue;
+
+		{
+			LatencyRecorder::Scope scope(latencyRecorder_.get(), "integrate");
+			std::unique_lock<std::mutex> lock(volumeMutex_);
+			TSDFIntegrator::integrate(*volume_, *frame->rgbdImage, intrinsic_, frame->pose);
+		}
+		numberOfFrames++;
+
+		if(meshInterval_ > 0 && numberOfFrames % meshInterval_ == 0)
+			meshQueue_->tryPush(frame);
 	}
+	meshQueue_->close();
+}
 
-	posvec_.push_back(pos_);
+/**
+ * Mesh extraction stage: Extracts a triangle mesh from the current volume.
+ */
+void Stitcher::meshEntry()
+{
+	Trace::setThreadName("Stitcher mesh");
+	PipelineFramePtr frame;
+	while(meshQueue_->pop(frame))
+	{
+		if(discard_)
+			continue;
 
-	oldRGBDImage_ = source;
+		std::shared_ptr<open3d::geometry::TriangleMesh> mesh;
+		{
+			LatencyRecorder::Scope scope(latencyRecorder_.get(), "mesh_extraction_online");
+			std::unique_lock<std::mutex> lock(volumeMutex_);
+			mesh = volume_->ExtractTriangleMesh();
+		}
 
-	/*{
-		std::ostringstream ostr;
-		ostr << "mesh_online_" << transvec_.size() << ".ply";
-		auto mesh = volume_->ExtractTriangleMesh();
-		open3d::io::WriteTriangleMesh(ostr.str(),
-			*mesh);
-	}*/
+		std::unique_lock<std::mutex> lock(meshMutex_);
+		mesh_ = mesh;
+	}
+}
+
+/**
+ * Pose graph stage: Registers the new keyframes and reoptimizes the keyframe
+ * graph whenever poseGraphInterval_ keyframes were added.
+ */
+void Stitcher::poseGraphEntry()
+{
+	Trace::setThreadName("Stitcher pose graph");
+	std::unique_lock<std::mutex> lock(poseGraphMutex_);
+	while (!stopPoseGraph_)
+	{
+		if (keyframeGraph_.getPendingKeyframes() < static_cast<size_t>(poseGraphInterval_))
+		{
+			poseGraphCondition_.wait(lock);
+			continue;
+		}
+
+		lock.unlock();
+		keyframeGraph_.update();
+		lock.lock();
+	}
+}
+
+std::shared_ptr<open3d::geometry::TriangleMesh> Stitcher::getTriangleMesh()
+{
+	std::unique_lock<std::mutex> lock(meshMutex_);
+	return mesh_;
 }
 
 void Stitcher::saveVolume()
 {
-	auto mesh = volume_->ExtractTriangleMesh();
-	open3d::io::WriteTriangleMesh("mesh_online.ply",
-		*mesh);
+	TRACE_SCOPE("Stitcher::saveVolume");
+	std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+	{
+		TRACE_SCOPE("wait Stitcher::mutex_");
+		lock.lock();
+	}
+
+	// Let the pipeline finish the queued frames, the stages' state is used below
+	{
+		TRACE_SCOPE("Stitcher drain pipeline");
+		stopPipeline(false);
+	}
+	printStatistics();
+
+	LatencyRecorder *recorder = latencyRecorder_.get();
+	if ((saveStages_ & SAVE_ONLINE_MESH) && volume_)
+	{
+		std::shared_ptr<open3d::geometry::TriangleMesh> mesh;
+		{
+			LatencyRecorder::Scope scope(recorder, "mesh_extraction_online_final");
+			mesh = volume_->ExtractTriangleMesh();
+		}
+		{
+			LatencyRecorder::Scope scope(recorder, "ply_write_online");
+			open3d::io::WriteTriangleMesh(onlineMeshFile_,
+				*mesh);
+		}
+		std::cout << "Online mesh saved" << std::endl;
+	}
 	/*{
 		std::ostringstream ostr;
 		ostr << "mesh_online_" << variant_ << ".ply";
@@ -149,111 +558,156 @@ void Stitcher::saveVolume()
 			*mesh);
 	}*/
 
-	std::cout << "Online mesh saved" << std::endl;
+	const size_t numFrames = frameStore_.size();
+	if (numFrames == 0 || !(saveStages_ & (SAVE_OPTIMIZED_MESH | SAVE_COLOR_MESH)))
+	{
+		if (!frameStore_.isReadOnly())
+			startPipeline();
+		return;
+	}
+
+	const std::vector<size_t> keyframeIndices = frameStore_.getKeyframes();
+	const open3d::camera::PinholeCameraIntrinsic &intrinsic = intrinsic_;
+
+	open3d::utility::SetVerbosityLevel(open3d::utility::VerbosityLevel::Debug);
+
+	// Only the keyframes since the last online update are left to register
+	{
+		TRACE_SCOPE("Stitcher keyframe graph");
+		keyframeGraph_.update();
+	}
+	const std::vector<Eigen::Matrix4d> poses = keyframeGraph_.getFramePoses(posvec_);
 
-	const size_t keyFrameInterval = 3;
-	const size_t maxKeyFrameDistance = 9;
-	open3d::camera::PinholeCameraIntrinsic intrinsic = open3d::camera::PinholeCameraIntrinsic(
-		open3d::camera::PinholeCameraIntrinsicParameters::PrimeSenseDefault);
+	open3d::utility::SetVerbosityLevel(open3d::utility::VerbosityLevel::Error);
 
-	open3d::pipelines::registration::PoseGraph poseGraph;
-	Eigen::Matrix4d transOdometry = Eigen::Matrix4d::Identity(), transOdometryInv;
-	poseGraph.nodes_.push_back(open3d::pipelines::registration::PoseGraphNode(transOdometry));
+	// Integrate, the volume of the last save is updated where the poses changed
+	if (!optVolume_ || optVolume_->voxel_length_ != optimizedVoxelLength_)
+	{
+		optVolume_ = std::make_unique<open3d::pipelines::integration::ScalableTSDFVolume>(optimizedVoxelLength_, 0.04, open3d::pipelines::integration::TSDFVolumeColorType::RGB8);
+		integratedPoses_.clear();
+		isIntegrated_.clear();
+	}
+	integratedPoses_.resize(poses.size(), Eigen::Matrix4d::Identity());
+	isIntegrated_.resize(poses.size(), false);
 
-	for (size_t i = 0; i < images_.size() - 1; i++)
+	int reintegratedFrames = 0, unchangedFrames = 0, untrackedFrames = 0;
+	for (size_t i = 0; i < poses.size(); i++)
 	{
-		for (size_t j = i + 1; j < images_.size(); j++)
+		// Its pose is only the previous frame's, integrating it would smear the surface
+		if (frameStore_.isTrackingFailed(i))
 		{
-			bool isNeighbour = (j == i + 1);
-			bool doLoopClosure = (i % keyFrameInterval == 0 && j % keyFrameInterval == 0 && (j-i) <= maxKeyFrameDistance);
+			untrackedFrames++;
+			continue;
+		}
 
-			const open3d::geometry::RGBDImage& source = images_[i];
-			const open3d::geometry::RGBDImage& target = images_[j];
+		Eigen::Matrix4d poseInv = poses[i].inverse();
+		if (isIntegrated_[i] && !hasPoseChanged(integratedPoses_[i], poseInv))
+		{
+			unchangedFrames++;
+			continue;
+		}
 
-			if (isNeighbour)
-			{
-				//Eigen::Matrix4d odo_init = Eigen::Matrix4d::Identity();
-				//std::tuple<bool, Eigen::Matrix4d, Eigen::Matrix6d> rgbd_odo =
-				//	open3d::pipelines::odometry::ComputeRGBDOdometry(
-				//		source, target, intrinsic, odo_init,
-				//		open3d::pipelines::odometry::RGBDOdometryJacobianFromHybridTerm(),
-				//		open3d::pipelines::odometry::OdometryOption());
-				//
-				//transOdometry = std::get<1>(rgbd_odo) * transOdometry;
-				transOdometry = posvec_[j];
-				transOdometryInv = transOdometry.inverse();
-				poseGraph.nodes_.push_back(open3d::pipelines::registration::PoseGraphNode(transOdometryInv));
-				poseGraph.edges_.push_back(open3d::pipelines::registration::PoseGraphEdge(i, j,
-//					std::get<1>(rgbd_odo), std::get<2>(rgbd_odo), false));
-					transvec_[j], infovec_[j], false));
-			}
-			else if (doLoopClosure)
+		auto image = frameStore_.get(i);
+		if (image)
+		{
+			LatencyRecorder::Scope scope(recorder, "integrate_optimized");
+			if (isIntegrated_[i])
 			{
-				Eigen::Matrix4d odo_init = Eigen::Matrix4d::Identity();
-				std::tuple<bool, Eigen::Matrix4d, Eigen::Matrix6d> rgbd_odo =
-					open3d::pipelines::odometry::ComputeRGBDOdometry(
-						source, target, intrinsic, odo_init,
-						open3d::pipelines::odometry::RGBDOdometryJacobianFromHybridTerm(),
-						open3d::pipelines::odometry::OdometryOption({ 20,10,5 }, 0.1));
-				if (std::get<0>(rgbd_odo))	// if success==true
-				{
-					poseGraph.edges_.push_back(open3d::pipelines::registration::PoseGraphEdge(i, j,
-						std::get<1>(rgbd_odo), std::get<2>(rgbd_odo), true));
-				}
+				TSDFIntegrator::integrate(*optVolume_, *image, intrinsic, integratedPoses_[i], -1.0f);
+				reintegratedFrames++;
 			}
+			TSDFIntegrator::integrate(*optVolume_, *image, intrinsic, poseInv);
+			integratedPoses_[i] = poseInv;
+			isIntegrated_[i] = true;
 		}
 	}
+	std::cout << "Optimized volume: " << reintegratedFrames << " frames moved, " << unchangedFrames << " unchanged, "
+		<< untrackedFrames << " skipped (tracking failed)" << std::endl;
 
-	open3d::utility::SetVerbosityLevel(open3d::utility::VerbosityLevel::Debug);
-
-	// Global optimization
-	open3d::pipelines::registration::GlobalOptimization(poseGraph);
-
-	open3d::utility::SetVerbosityLevel(open3d::utility::VerbosityLevel::Error);
-
-	// Integrate
-	open3d::pipelines::integration::ScalableTSDFVolume optVolume(2.0 / 512, 0.04, open3d::pipelines::integration::TSDFVolumeColorType::RGB8);
-
-	for (size_t i = 0; i < poseGraph.nodes_.size(); i++)
+	// Simplify
+	std::shared_ptr<open3d::geometry::TriangleMesh> optMesh, simplMesh;
 	{
-		auto pose = poseGraph.nodes_[i].pose_;
-		Eigen::Matrix4d poseInv = pose.inverse();
-		optVolume.Integrate(images_[i], intrinsic, poseInv);
+		LatencyRecorder::Scope scope(recorder, "mesh_extraction_optimized");
+		optMesh = optVolume_->ExtractTriangleMesh();
+	}
+	{
+		LatencyRecorder::Scope scope(recorder, "simplify");
+		simplMesh = optMesh->SimplifyQuadricDecimation(static_cast<int>(optMesh->triangles_.size() / 2), std::numeric_limits<double>::infinity(), 1.0);
+	}
+	if (saveStages_ & SAVE_OPTIMIZED_MESH)
+	{
+		LatencyRecorder::Scope scope(recorder, "ply_write_opt");
+		open3d::io::WriteTriangleMesh(optimizedMeshFile_,
+			*simplMesh);
+		std::cout << "Optimized mesh saved" << std::endl;
 	}
 
-	// Simplify
-	auto optMesh = optVolume.ExtractTriangleMesh();
-	auto simplMesh = optMesh->SimplifyQuadricDecimation(static_cast<int>(optMesh->triangles_.size() / 2), std::numeric_limits<double>::infinity(), 1.0);
-	open3d::io::WriteTriangleMesh("mesh_opt.ply",
-		*simplMesh);
-
-	std::cout << "Optimized mesh saved" << std::endl;
+	if (!(saveStages_ & SAVE_COLOR_MESH))
+	{
+		if (!frameStore_.isReadOnly())
+			startPipeline();
+		return;
+	}
 
 	// Subdivide the mesh to allow for finer color resolution
 	auto subdivMesh = simplMesh->SubdivideLoop(1);
 
-	// Optimize color map
+	// Optimize color map with the keyframes, which cover the scene. Besides the
+	// image (7 bytes per pixel), the optimization keeps about 20 bytes per pixel of
+	// gray, gradient, depth and mask images for each, so long scans are subsampled
+	// evenly along the trajectory to stay within the frame memory limit.
+	const size_t bytesPerKeyframe = static_cast<size_t>(std::max(intrinsic.width_ * intrinsic.height_, 1)) * 27;
+	const size_t maxKeyframes = std::max<size_t>(frameStore_.getMemoryLimit() / bytesPerKeyframe, 1);
+	const size_t numColorMapFrames = std::min(keyframeIndices.size(), maxKeyframes);
+	std::vector<size_t> colorMapFrames;
+	for (size_t k = 0; k < numColorMapFrames; k++)
+		colorMapFrames.push_back(keyframeIndices[k * keyframeIndices.size() / numColorMapFrames]);
+	std::cout << "Color map: " << colorMapFrames.size() << " of " << keyframeIndices.size() << " keyframes" << std::endl;
+
 	open3d::pipelines::color_map::ColorMapOptimizationOption option(true);
 	open3d::camera::PinholeCameraTrajectory camera;
-	for (size_t i = 0; i < poseGraph.nodes_.size(); i++)
+	open3d::geometry::RGBDImagePyramid rgbdImages;
+	for (size_t i : colorMapFrames)
 	{
-		auto pose = poseGraph.nodes_[i].pose_;
-		Eigen::Matrix4d poseInv = pose.inverse();
+		auto image = frameStore_.get(i);
+		if (!image)
+			continue;
+
+		Eigen::Matrix4d poseInv = poses[i].inverse();
 		open3d::camera::PinholeCameraParameters cameraParams;
 		cameraParams.intrinsic_ = intrinsic;
 		cameraParams.extrinsic_ = poseInv;
 		camera.parameters_.push_back(cameraParams);
+
+		// Shared instead of copied, ColorMapOptimization only reads the images
+		rgbdImages.push_back(std::const_pointer_cast<open3d::geometry::RGBDImage>(image));
 	}
-	open3d::geometry::RGBDImagePyramid rgbdImages;
-	for (const auto& img : images_)
 	{
-		rgbdImages.push_back(std::make_shared<open3d::geometry::RGBDImage>(img));
+		LatencyRecorder::Scope scope(recorder, "color_map");
+		open3d::pipelines::color_map::ColorMapOptimization(*subdivMesh, rgbdImages, camera, option);
 	}
-	open3d::pipelines::color_map::ColorMapOptimization(*subdivMesh, rgbdImages, camera, option);
 
-	open3d::io::WriteTriangleMesh("mesh_color_opt.ply",
-		*subdivMesh);
+	{
+		LatencyRecorder::Scope scope(recorder, "ply_write_color");
+		open3d::io::WriteTriangleMesh(colorMeshFile_,
+			*subdivMesh);
+	}
+	std::cout << "Color optimized mesh saved" << std::endl;
 
+	if (!frameStore_.isReadOnly())
+		startPipeline();
+}
+
+/**
+ * Whether a frame integrated with oldPose has to be reintegrated with newPose (both extrinsics).
+ */
+bool Stitcher::hasPoseChanged(const Eigen::Matrix4d &oldPose, const Eigen::Matrix4d &newPose) const
+{
+	const Eigen::Matrix4d motion = newPose * oldPose.inverse();
+	const double translation = motion.block<3, 1>(0, 3).norm();
+	const double cosAngle = std::min(1.0, std::max(-1.0, 0.5 * (motion.block<3, 3>(0, 0).trace() - 1.0)));
+	const double rotation = std::acos(cosAngle);
+	return (translation > reintegrationTranslation_ || rotation > reintegrationRotation_);
 }
 
 void Stitcher::reset()
@@ -270,14 +724,72 @@ void Stitcher::reset()
 
 	std::cout << "Reset" << std::endl;
 
-
-	oldRGBDImage_.Clear();
-	pos_ = Eigen::Matrix4d::Identity();
+	stopPipeline(true);
+	printStatistics();
+	clearScan();
 
 	setup();
 	//volume_->Reset();
+}
+
+/**
+ * Replaces the scan by a recorded frame journal, so that saveVolume() can be
+ * rerun without the sensor. The pipeline stays stopped until reset().
+ */
+bool Stitcher::loadJournal(const std::string &filename)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	stopPipeline(true);
+	clearScan();
+
+	if (!frameStore_.load(filename))
+		return false;
+	// The scan's own intrinsics, if the journal has them
+	setIntrinsic(frameStore_.getIntrinsic());
+
+	for (size_t i = 0; i < frameStore_.size(); i++)
+	{
+		auto info = frameStore_.getFrameInfo(i);
+		posvec_.push_back(info->pose);
+		transvec_.push_back(info->transform);
+		infovec_.push_back(info->information);
+		if (info->isKeyframe)
+			keyframeGraph_.addKeyframe(i, info->pose);
+	}
+	processedFrames_ = static_cast<int>(frameStore_.size());
+
+	std::cout << "Loaded " << frameStore_.size() << " frames from " << filename << std::endl;
+	return true;
+}
+
+/**
+ * Forgets all frames, poses and statistics of the current scan.
+ *
+ * Must be called with mutex_ held and the pipeline stopped.
+ */
+void Stitcher::clearScan()
+{
+	droppedFrames_ = 0;
+	skippedFrames_ = 0;
+	processedFrames_ = 0;
+	modelTrackedFrames_ = 0;
+	priorRetries_ = 0;
+	keyframeDepth_.clear();
+	{
+		std::unique_lock<std::mutex> lock(odometryStatisticsMutex_);
+		odometryStatistics_.clear();
+	}
+
+	oldOdometryFrame_.reset();
+	isVelocityValid_ = false;
+	pos_ = Eigen::Matrix4d::Identity();
 
-	images_.clear();
+	frameStore_.clear();
+	keyframeGraph_.clear();
+	optVolume_.reset();
+	integratedPoses_.clear();
+	isIntegrated_.clear();
 	posvec_.clear();
 	transvec_.clear();
 	infovec_.clear();
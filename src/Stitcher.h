@@ -2,16 +2,34 @@
 #define STITCHER_H
 
 #include "StitcherI.h"
+#include "BoundedQueue.h"
+#include "RGBDOdometry.h"
+#include "FrameStore.h"
+#include "KeyframeGraph.h"
+#include "LatencyRecorder.h"
 
 #include "open3d/Open3D.h"
 
 #include <vector>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <string>
 
 #include <Eigen/StdVector>
 
 /*
+ * Integrates RGBD frames into a TSDF volume.
  *
+ * The work is split into pipeline stages (preprocess, odometry, integrate and
+ * mesh extraction), each running on its own thread and connected by bounded
+ * queues, so frame N+1 can be preprocessed while frame N is being integrated.
+ *
+ * By default, frames are tracked against a raycast of the volume rather than
+ * the previous frame, which keeps the drift (and the work in saveVolume()) low.
  */
 class Stitcher : public StitcherI
 {
@@ -19,6 +37,37 @@ public:
 	Stitcher();
 	virtual ~Stitcher();
 
+	/**
+	 * What addNewImage() does when the pipeline cannot keep up with the sensor.
+	 */
+	enum BackpressureMode
+	{
+		BACKPRESSURE_BLOCK,			//!< Wait until the pipeline accepts the frame (blocks the caller)
+		BACKPRESSURE_DROP_OLDEST,	//!< Replace the oldest queued frame, keeps latency low
+		BACKPRESSURE_DROP_NEWEST,	//!< Drop the incoming frame, keeps the queued frames
+		BACKPRESSURE_KEYFRAME_ONLY	//!< Skip frames with little motion, queue the others blocking
+	};
+
+	/**
+	 * What each new frame is registered against.
+	 */
+	enum TrackingMode
+	{
+		TRACKING_FRAME_TO_FRAME,	//!< The previous frame, drift accumulates from frame to frame
+		TRACKING_FRAME_TO_MODEL		//!< A raycast of the TSDF volume at the previous pose (KinectFusion style)
+	};
+
+	/**
+	 * Results written by saveVolume(), combined with |.
+	 */
+	enum SaveStage
+	{
+		SAVE_ONLINE_MESH = 1,		//!< Mesh of the online volume
+		SAVE_OPTIMIZED_MESH = 2,	//!< Mesh after pose graph optimization and reintegration
+		SAVE_COLOR_MESH = 4,		//!< Optimized mesh with optimized color map
+		SAVE_ALL = SAVE_ONLINE_MESH | SAVE_OPTIMIZED_MESH | SAVE_COLOR_MESH
+	};
+
 	virtual void setup();
 
 	virtual void addNewImage(const open3d::geometry::Image& colorImg, const open3d::geometry::Image& depthImg);
@@ -27,22 +76,263 @@ public:
 
 	virtual void reset();
 
-	virtual void setDepthScale(double depthScale) { depthScale_ = depthScale; }
+	virtual void setDepthScale(double depthScale)
+	{
+		depthScale_ = depthScale;
+		frameStore_.setDepthScale(depthScale);
+	}
+
+	/**
+	 * Frames kept for saveVolume() beyond this many bytes are spilled to disk.
+	 * The keyframes used for the color map are limited to fit as well.
+	 */
+	void setFrameMemoryLimit(size_t bytes) { frameStore_.setMemoryLimit(bytes); }
+	/**
+	 * All processed frames and their online poses are recorded in this file.
+	 */
+	void setJournalFile(const std::string &filename) { frameStore_.setJournalFile(filename); }
+	/**
+	 * True if the journal of the scan could not be written, see FrameStore::isJournalFailed().
+	 */
+	bool isJournalFailed() { return frameStore_.isJournalFailed(); }
+
+	bool loadJournal(const std::string &filename);
+
+	/**
+	 * Voxel size (in metres) of the online volume and of the volume rebuilt by
+	 * saveVolume(). The online one takes effect with the next setup() or reset().
+	 */
+	void setVoxelLength(double onlineVoxelLength, double optimizedVoxelLength)
+	{
+		onlineVoxelLength_ = onlineVoxelLength;
+		optimizedVoxelLength_ = optimizedVoxelLength;
+	}
+
+	/**
+	 * Camera intrinsics of the depth images, must be set before setup().
+	 * loadJournal() replaces them by those recorded in the journal.
+	 */
+	void setIntrinsic(const open3d::camera::PinholeCameraIntrinsic &intrinsic)
+	{
+		intrinsic_ = intrinsic;
+		keyframeGraph_.setIntrinsic(intrinsic);
+		frameStore_.setIntrinsic(intrinsic);
+	}
+	const open3d::camera::PinholeCameraIntrinsic &getIntrinsic() const { return intrinsic_; }
+
+	void setSaveStages(int saveStages) { saveStages_ = saveStages; }
+	void setOutputFiles(const std::string &onlineMeshFile, const std::string &optimizedMeshFile, const std::string &colorMeshFile)
+	{
+		onlineMeshFile_ = onlineMeshFile;
+		optimizedMeshFile_ = optimizedMeshFile;
+		colorMeshFile_ = colorMeshFile;
+	}
+
+	/**
+	 * Iterations per pyramid level of the frame odometry, coarsest level first.
+	 * The number of entries sets the number of pyramid levels. Must be set before setup().
+	 */
+	void setOdometryIterations(const std::vector<int> &iterations) { odometryOption_.iteration_number_per_pyramid_level_ = iterations; }
+
+	/**
+	 * saveVolume() keeps the optimized volume; on the next save, a frame is only
+	 * removed and integrated again if its optimized pose moved by more than
+	 * translation (in metres) or rotation (in radians).
+	 */
+	void setReintegrationThreshold(double translation, double rotation)
+	{
+		reintegrationTranslation_ = translation;
+		reintegrationRotation_ = rotation;
+	}
+
+	/**
+	 * Records the time spent in each stage, nullptr disables it. Must be set before setup().
+	 */
+	void setLatencyRecorder(const std::shared_ptr<LatencyRecorder> &latencyRecorder)
+	{
+		latencyRecorder_ = latencyRecorder;
+		keyframeGraph_.setLatencyRecorder(latencyRecorder);
+	}
+
+	/**
+	 * Extract a mesh every meshInterval integrated frames, for getTriangleMesh().
+	 * Each extraction holds up the integration. Default 0, no online meshes.
+	 */
+	void setMeshInterval(int meshInterval) { meshInterval_ = meshInterval; }
+
+	void setBackpressureMode(BackpressureMode mode) { backpressureMode_ = mode; }
+	BackpressureMode getBackpressureMode() const { return backpressureMode_; }
+
+	void setTrackingMode(TrackingMode mode) { trackingMode_ = mode; }
+	TrackingMode getTrackingMode() const { return trackingMode_; }
+
+	/**
+	 * In frame-to-model mode, the previous frame is used instead of the model view
+	 * if less than the given fraction of the model view's pixels show a surface.
+	 */
+	void setMinModelCoverage(double fraction) { minModelCoverage_ = fraction; }
+
+	/**
+	 * Initialize the odometry with the motion of the previous frame (constant
+	 * velocity model) instead of identity. Falls back to identity if that fails.
+	 */
+	void setUseMotionPrior(bool useMotionPrior) { useMotionPrior_ = useMotionPrior; }
+
+	/**
+	 * In keyframe-only mode, a frame is skipped unless more than the given fraction
+	 * of its depth samples changed by more than depthChange (in metres).
+	 */
+	void setKeyframeMotionThreshold(double fraction, double depthChange)
+	{
+		keyframeMotionFraction_ = fraction;
+		keyframeDepthChange_ = depthChange;
+	}
+
+	/**
+	 * Besides its successors, saveVolume() registers a keyframe with earlier ones
+	 * whose cameras are within radius (in metres), look in a direction at most
+	 * maxAngle (in radians) apart and whose images correlate by at least
+	 * minSimilarity. See LoopClosureIndex.
+	 */
+	void setLoopClosureSearch(double radius, double maxAngle, double minSimilarity)
+	{
+		keyframeGraph_.setLoopClosureSearch(radius, maxAngle, minSimilarity);
+	}
+
+	/**
+	 * While scanning, the keyframe pose graph is extended and reoptimized in the
+	 * background every interval keyframes, so saveVolume() only has to add the
+	 * last ones. 0 builds the whole graph in saveVolume(). Must be set before setup().
+	 */
+	void setPoseGraphInterval(int interval) { poseGraphInterval_ = interval; }
+
+	/**
+	 * Frames dropped because the pipeline was full.
+	 */
+	int getDroppedFrames() const { return droppedFrames_; }
+	/**
+	 * Frames skipped in keyframe-only mode because of too little motion.
+	 */
+	int getSkippedFrames() const { return skippedFrames_; }
+	/**
+	 * Frames that went through odometry.
+	 */
+	int getProcessedFrames() const { return processedFrames_; }
+	/**
+	 * Frames that were registered against the model view.
+	 */
+	int getModelTrackedFrames() const { return modelTrackedFrames_; }
+	/**
+	 * Frames whose odometry failed with the motion prior and was repeated from identity.
+	 */
+	int getPriorRetries() const { return priorRetries_; }
+	/**
+	 * Odometry iterations and time for each processed frame, in processing order.
+	 * The first frame after a reset has no odometry and an empty entry.
+	 */
+	std::vector<OdometryStatistics> getOdometryStatistics();
+	/**
+	 * Frames currently waiting in the pipeline queues.
+	 */
+	int getQueuedFrames();
+
+	/**
+	 * Returns the most recent online mesh, or nullptr if none was extracted yet.
+	 */
+	std::shared_ptr<open3d::geometry::TriangleMesh> getTriangleMesh();
 
 private:
+	/**
+	 * One frame travelling through the pipeline, filled in by the stages.
+	 */
+	struct PipelineFrame
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		open3d::geometry::Image colorImg, depthImg;
+		std::shared_ptr<open3d::geometry::RGBDImage> rgbdImage;
+		std::shared_ptr<const OdometryFrame> odometryFrame;
+		uint64_t timestamp;	// Microseconds
+		Eigen::Matrix4d pose;
+	};
+	typedef std::shared_ptr<PipelineFrame> PipelineFramePtr;
+
+	void startPipeline();
+	void stopPipeline(bool discard);
+
+	void preprocessEntry();
+	void odometryEntry();
+	void integrateEntry();
+	void meshEntry();
+	void poseGraphEntry();
+
+	bool isKeyframe(const open3d::geometry::Image& depthImg);
+	void clearScan();
+	bool hasPoseChanged(const Eigen::Matrix4d &oldPose, const Eigen::Matrix4d &newPose) const;
+	std::shared_ptr<const OdometryFrame> raycastModel(const Eigen::Matrix4d &pose);
+	void printStatistics();
+
+	// Guards the pipeline (queues and threads) against concurrent reset/save
 	std::mutex mutex_;
 
 	double depthScale_{ 1000.0 };
+	double onlineVoxelLength_{ 4.0 / 512 }, optimizedVoxelLength_{ 2.0 / 512 };
+	int saveStages_{ SAVE_ALL };
+	std::string onlineMeshFile_{ "mesh_online.ply" }, optimizedMeshFile_{ "mesh_opt.ply" }, colorMeshFile_{ "mesh_color_opt.ply" };
+	int meshInterval_{ 0 };
+	BackpressureMode backpressureMode_{ BACKPRESSURE_DROP_OLDEST };
+	TrackingMode trackingMode_{ TRACKING_FRAME_TO_MODEL };
+	double minModelCoverage_{ 0.2 };
+	bool useMotionPrior_{ true };
+	double keyframeMotionFraction_{ 0.1 }, keyframeDepthChange_{ 0.02 };
+	int poseGraphInterval_{ 10 };
+	double reintegrationTranslation_{ 0.002 }, reintegrationRotation_{ 0.001 };
+	open3d::camera::PinholeCameraIntrinsic intrinsic_;
+	open3d::pipelines::odometry::OdometryOption odometryOption_;
+	std::shared_ptr<LatencyRecorder> latencyRecorder_;
 
-	open3d::geometry::RGBDImage oldRGBDImage_;
+	static const size_t queueCapacity_ = 2;
+	std::unique_ptr<BoundedQueue<PipelineFramePtr> > preprocessQueue_, odometryQueue_, integrateQueue_, meshQueue_;
+	std::thread preprocessThread_, odometryThread_, integrateThread_, meshThread_;
+	std::atomic<bool> discard_{ false };
 
-	Eigen::Matrix4d pos_;
+	std::atomic<int> droppedFrames_{ 0 }, skippedFrames_{ 0 }, processedFrames_{ 0 }, modelTrackedFrames_{ 0 }, priorRetries_{ 0 };
 
-	std::unique_ptr<open3d::pipelines::integration::ScalableTSDFVolume> volume_;
+	// Sparse depth samples of the last keyframe, only accessed in addNewImage()
+	std::vector<uint16_t> keyframeDepth_;
+
+	// Only accessed by the odometry stage while the pipeline runs
+	std::shared_ptr<const OdometryFrame> oldOdometryFrame_;
+	RGBDOdometry odometry_;
+	bool isVelocityValid_{ false };	// transvec_.back() is the motion of the previous frame
+	std::mutex odometryStatisticsMutex_;
+	std::vector<OdometryStatistics> odometryStatistics_;
+	open3d::geometry::RGBDImage modelImage_;
 
-	std::vector<open3d::geometry::RGBDImage> images_;
+	Eigen::Matrix4d pos_;
+
+	FrameStore frameStore_;
 	std::vector<Eigen::Matrix4d> posvec_, transvec_;
 	std::vector<Eigen::Matrix6d> infovec_;
+
+	// Fed by the odometry stage, updated by the pose graph stage while the pipeline runs
+	KeyframeGraph keyframeGraph_;
+	std::thread poseGraphThread_;
+	std::mutex poseGraphMutex_;
+	std::condition_variable poseGraphCondition_;
+	bool stopPoseGraph_{ false };
+
+	// Shared between the integrate and mesh extraction stages
+	std::mutex volumeMutex_;
+	std::unique_ptr<open3d::pipelines::integration::ScalableTSDFVolume> volume_;
+
+	// Volume of the last saveVolume() and the pose each frame is integrated with
+	std::unique_ptr<open3d::pipelines::integration::ScalableTSDFVolume> optVolume_;
+	std::vector<Eigen::Matrix4d> integratedPoses_;
+	std::vector<bool> isIntegrated_;
+
+	std::mutex meshMutex_;
+	std::shared_ptr<open3d::geometry::TriangleMesh> mesh_;
 };
 
 #endif
@@ -0,0 +1,236 @@
+#include "TSDFIntegrator.h"
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <unordered_set>
+#include <iostream>
+
+namespace
+{
+	typedef open3d::pipelines::integration::ScalableTSDFVolume Volume;
+	typedef open3d::pipelines::integration::UniformTSDFVolume VolumeUnit;
+	typedef decltype(VolumeUnit::voxels_)::value_type Voxel;
+	typedef std::unordered_set<Eigen::Vector3i, open3d::utility::hash_eigen<Eigen::Vector3i> > UnitIndexSet;
+
+	/**
+	 * The camera parameters shared by all volume units of one image.
+	 */
+	struct Projection
+	{
+		Eigen::Matrix3f rotation;
+		Eigen::Vector3f translation;
+		float fx, fy, cx, cy;
+		float sdfTrunc;
+		float weight;
+		std::vector<float> distanceMultipliers;	// Converts depth to distance along the ray, per pixel
+	};
+
+	/**
+	 * Indices of the volume units within the truncation distance of the
+	 * depth samples, like ScalableTSDFVolume::Integrate().
+	 */
+	void findUnits(const Volume &volume, const open3d::geometry::Image &depth,
+		const open3d::camera::PinholeCameraIntrinsic &intrinsic, const Eigen::Matrix4d &extrinsic,
+		UnitIndexSet &unitIndices)
+	{
+		const Eigen::Matrix4d cameraToWorld = extrinsic.inverse();
+		const Eigen::Matrix3d R = cameraToWorld.block<3, 3>(0, 0);
+		const Eigen::Vector3d t = cameraToWorld.block<3, 1>(0, 3);
+		const Eigen::Matrix3d &K = intrinsic.intrinsic_matrix_;
+		const double fx = K(0, 0), fy = K(1, 1), cx = K(0, 2), cy = K(1, 2);
+		const double unitLength = volume.volume_unit_length_;
+		const Eigen::Vector3d trunc = Eigen::Vector3d::Constant(volume.sdf_trunc_);
+		const int stride = std::max(volume.depth_sampling_stride_, 1);
+		const int numRows = (depth.height_ + stride - 1) / stride;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+		{
+			// Neighbouring samples mostly hit the same units, so the thread's own set stays small
+			UnitIndexSet unitIndicesPrivate;
+
+#ifdef _OPENMP
+#pragma omp for nowait
+#endif
+			for(int row = 0; row < numRows; row++)
+			{
+				const int v = row * stride;
+				const float *pDepth = depth.PointerAt<float>(0, v);
+				for(int u = 0; u < depth.width_; u += stride)
+				{
+					const double d = pDepth[u];
+					if(d <= 0)
+						continue;
+
+					const Eigen::Vector3d p = R * Eigen::Vector3d((u - cx) * d / fx, (v - cy) * d / fy, d) + t;
+					const Eigen::Vector3d minBound = (p - trunc) / unitLength, maxBound = (p + trunc) / unitLength;
+					const Eigen::Vector3i minIndex(static_cast<int>(std::floor(minBound(0))),
+						static_cast<int>(std::floor(minBound(1))), static_cast<int>(std::floor(minBound(2))));
+					const Eigen::Vector3i maxIndex(static_cast<int>(std::floor(maxBound(0))),
+						static_cast<int>(std::floor(maxBound(1))), static_cast<int>(std::floor(maxBound(2))));
+					for(int x = minIndex(0); x <= maxIndex(0); x++)
+						for(int y = minIndex(1); y <= maxIndex(1); y++)
+							for(int z = minIndex(2); z <= maxIndex(2); z++)
+								unitIndicesPrivate.insert(Eigen::Vector3i(x, y, z));
+				}
+			}
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+			{
+				unitIndices.insert(unitIndicesPrivate.begin(), unitIndicesPrivate.end());
+			}
+		}
+	}
+
+	/**
+	 * Updates the voxels of one volume unit, the same computation as
+	 * UniformTSDFVolume::IntegrateWithDepthToCameraDistanceMultiplier()
+	 * generalized to any (also negative) weight.
+	 */
+	void integrateUnit(VolumeUnit &unit, const open3d::geometry::Image &depth,
+		const open3d::geometry::Image *color, const Projection &projection)
+	{
+		const int resolution = unit.resolution_;
+		const float voxelLength = static_cast<float>(unit.voxel_length_);
+		const Eigen::Vector3f origin = unit.origin_.cast<float>();
+		const float maxU = depth.width_ - 0.0001f, maxV = depth.height_ - 0.0001f;
+		const Eigen::Vector3f step = projection.rotation.col(2) * voxelLength;
+		const float weight = projection.weight;
+
+		for(int x = 0; x < resolution; x++)
+		{
+			for(int y = 0; y < resolution; y++)
+			{
+				Voxel *voxel = &unit.voxels_[unit.IndexOf(x, y, 0)];
+				Eigen::Vector3f p = projection.rotation * (origin + voxelLength * Eigen::Vector3f(x + 0.5f, y + 0.5f, 0.5f))
+					+ projection.translation;
+				for(int z = 0; z < resolution; z++, voxel++, p += step)
+				{
+					if(p(2) <= 0)
+						continue;
+
+					const float uf = p(0) * projection.fx / p(2) + projection.cx + 0.5f;
+					const float vf = p(1) * projection.fy / p(2) + projection.cy + 0.5f;
+					if(!(uf >= 0.0001f && uf < maxU && vf >= 0.0001f && vf < maxV))
+						continue;
+
+					const int u = static_cast<int>(uf), v = static_cast<int>(vf);
+					const float d = *depth.PointerAt<float>(u, v);
+					if(d <= 0)
+						continue;
+
+					const float sdf = (d - p(2)) * projection.distanceMultipliers[v * depth.width_ + u];
+					if(sdf <= -projection.sdfTrunc)
+						continue;
+
+					const float tsdf = std::min(1.0f, sdf / projection.sdfTrunc);
+					const float newWeight = voxel->weight_ + weight;
+					if(newWeight <= 0)
+					{
+						// Nothing left of this voxel, unobserved like a new one
+						voxel->tsdf_ = 0;
+						voxel->color_.setZero();
+						voxel->weight_ = 0;
+						continue;
+					}
+
+					voxel->tsdf_ = (voxel->tsdf_ * voxel->weight_ + weight * tsdf) / newWeight;
+					if(color)
+					{
+						const uint8_t *rgb = color->PointerAt<uint8_t>(u, v, 0);
+						voxel->color_ = (voxel->color_ * voxel->weight_ + weight * Eigen::Vector3d(rgb[0], rgb[1], rgb[2])) / newWeight;
+					}
+					voxel->weight_ = newWeight;
+				}
+			}
+		}
+	}
+}
+
+void TSDFIntegrator::integrate(open3d::pipelines::integration::ScalableTSDFVolume &volume,
+	const open3d::geometry::RGBDImage &image, const open3d::camera::PinholeCameraIntrinsic &intrinsic,
+	const Eigen::Matrix4d &extrinsic, float weight)
+{
+	const open3d::geometry::Image &depth = image.depth_;
+	if(depth.num_of_channels_ != 1 || depth.bytes_per_channel_ != 4 ||
+		depth.width_ != intrinsic.width_ || depth.height_ != intrinsic.height_)
+	{
+		std::cerr << "TSDFIntegrator: Unsupported depth image format" << std::endl;
+		return;
+	}
+	const bool hasColor = (volume.color_type_ == open3d::pipelines::integration::TSDFVolumeColorType::RGB8);
+	if(hasColor && (image.color_.num_of_channels_ != 3 || image.color_.bytes_per_channel_ != 1 ||
+		image.color_.width_ != depth.width_ || image.color_.height_ != depth.height_))
+	{
+		std::cerr << "TSDFIntegrator: Unsupported color image format" << std::endl;
+		return;
+	}
+
+	UnitIndexSet unitIndices;
+	findUnits(volume, depth, intrinsic, extrinsic, unitIndices);
+
+	// Units are only created here, so the parallel part below does not modify the map
+	std::vector<VolumeUnit *> units;
+	std::vector<Eigen::Vector3i> newIndices;
+	units.reserve(unitIndices.size());
+	for(const Eigen::Vector3i &index : unitIndices)
+	{
+		auto it = volume.volume_units_.find(index);
+		if(it != volume.volume_units_.end() && it->second.volume_)
+			units.push_back(it->second.volume_.get());
+		else if(weight > 0)	// Nothing to remove where nothing was integrated
+			newIndices.push_back(index);
+	}
+
+	// Allocating a unit clears all its voxels, only the insertion into the map has to be serial
+	std::vector<std::shared_ptr<VolumeUnit> > newUnits(newIndices.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int k = 0; k < static_cast<int>(newIndices.size()); k++)
+	{
+		newUnits[k] = std::make_shared<VolumeUnit>(volume.volume_unit_length_, volume.volume_unit_resolution_,
+			volume.sdf_trunc_, volume.color_type_, newIndices[k].cast<double>() * volume.volume_unit_length_);
+	}
+	for(size_t k = 0; k < newIndices.size(); k++)
+	{
+		auto &unit = volume.volume_units_[newIndices[k]];
+		unit.volume_ = newUnits[k];
+		unit.index_ = newIndices[k];
+		units.push_back(newUnits[k].get());
+	}
+
+	Projection projection;
+	projection.rotation = extrinsic.block<3, 3>(0, 0).cast<float>();
+	projection.translation = extrinsic.block<3, 1>(0, 3).cast<float>();
+	const Eigen::Matrix3d &K = intrinsic.intrinsic_matrix_;
+	projection.fx = static_cast<float>(K(0, 0));
+	projection.fy = static_cast<float>(K(1, 1));
+	projection.cx = static_cast<float>(K(0, 2));
+	projection.cy = static_cast<float>(K(1, 2));
+	projection.sdfTrunc = static_cast<float>(volume.sdf_trunc_);
+	projection.weight = weight;
+	projection.distanceMultipliers.resize(static_cast<size_t>(depth.width_) * depth.height_);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(int v = 0; v < depth.height_; v++)
+	{
+		for(int u = 0; u < depth.width_; u++)
+		{
+			const float x = (u - projection.cx) / projection.fx, y = (v - projection.cy) / projection.fy;
+			projection.distanceMultipliers[v * depth.width_ + u] = std::sqrt(x * x + y * y + 1.0f);
+		}
+	}
+
+	const open3d::geometry::Image *color = hasColor ? &image.color_ : nullptr;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for(int k = 0; k < static_cast<int>(units.size()); k++)
+		integrateUnit(*units[k], depth, color, projection);
+}
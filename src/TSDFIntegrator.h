@@ -0,0 +1,33 @@
+#ifndef TSDFINTEGRATOR_H
+#define TSDFINTEGRATOR_H
+
+#include "open3d/Open3D.h"
+
+/**
+ * Integrates RGBD images into a ScalableTSDFVolume, like its Integrate(),
+ * but processes the touched volume units in parallel and can also remove
+ * an image again.
+ *
+ * The units within the truncation distance of the depth samples are found
+ * and the missing ones allocated in parallel; only their insertion into the
+ * volume's hash map is serial. Then each unit is updated by exactly one
+ * thread, so no locking is needed.
+ */
+class TSDFIntegrator
+{
+public:
+	/**
+	 * Integrates the image (float depth in metres, RGB8 color) seen with the
+	 * given intrinsic and extrinsic, with the given weight per observation.
+	 *
+	 * A weight of -1 removes an image that was integrated before with the same
+	 * extrinsic (de-integration); voxels whose weight drops to 0 are reset.
+	 *
+	 * The volume must not be accessed by other threads during the call.
+	 */
+	static void integrate(open3d::pipelines::integration::ScalableTSDFVolume &volume,
+		const open3d::geometry::RGBDImage &image, const open3d::camera::PinholeCameraIntrinsic &intrinsic,
+		const Eigen::Matrix4d &extrinsic, float weight = 1.0f);
+};
+
+#endif
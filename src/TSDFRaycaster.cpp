@@ -0,0 +1,206 @@
+#include "TSDFRaycaster.h"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	typedef open3d::pipelines::integration::ScalableTSDFVolume Volume;
+	typedef open3d::pipelines::integration::UniformTSDFVolume VolumeUnit;
+	typedef decltype(VolumeUnit::voxels_)::value_type Voxel;
+
+	inline int floorDiv(int a, int b)
+	{
+		return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+	}
+
+	/**
+	 * Voxel access by global voxel index, remembers the last volume unit
+	 * since consecutive lookups along a ray mostly hit the same one.
+	 */
+	class VoxelLookup
+	{
+	public:
+		explicit VoxelLookup(const Volume &volume)
+			: volume_(volume), resolution_(volume.volume_unit_resolution_)
+		{ }
+
+		const VolumeUnit *getUnit(const Eigen::Vector3i &unitIndex)
+		{
+			if(hasLastUnit_ && unitIndex == lastUnitIndex_)
+				return lastUnit_;
+
+			auto it = volume_.volume_units_.find(unitIndex);
+			lastUnit_ = (it != volume_.volume_units_.end()) ? it->second.volume_.get() : nullptr;
+			lastUnitIndex_ = unitIndex;
+			hasLastUnit_ = true;
+			return lastUnit_;
+		}
+
+		/**
+		 * Returns nullptr if the voxel was never observed.
+		 */
+		const Voxel *getVoxel(int x, int y, int z)
+		{
+			const Eigen::Vector3i unitIndex(floorDiv(x, resolution_), floorDiv(y, resolution_), floorDiv(z, resolution_));
+			const VolumeUnit *unit = getUnit(unitIndex);
+			if(!unit)
+				return nullptr;
+
+			const Voxel &voxel = unit->voxels_[unit->IndexOf(x - unitIndex(0) * resolution_,
+				y - unitIndex(1) * resolution_, z - unitIndex(2) * resolution_)];
+			return (voxel.weight_ > 0) ? &voxel : nullptr;
+		}
+
+		/**
+		 * Trilinear interpolation of the TSDF (and optionally the color) at p.
+		 *
+		 * Fails if one of the eight neighbouring voxels was never observed.
+		 */
+		bool interpolate(const Eigen::Vector3d &p, double &tsdf, Eigen::Vector3d *color)
+		{
+			const Eigen::Vector3d g = p / volume_.voxel_length_ - Eigen::Vector3d::Constant(0.5);
+			const int x0 = static_cast<int>(std::floor(g(0)));
+			const int y0 = static_cast<int>(std::floor(g(1)));
+			const int z0 = static_cast<int>(std::floor(g(2)));
+			const double fx = g(0) - x0, fy = g(1) - y0, fz = g(2) - z0;
+
+			tsdf = 0;
+			if(color)
+				color->setZero();
+			for(int i = 0; i < 8; i++)
+			{
+				const int dx = i & 1, dy = (i >> 1) & 1, dz = (i >> 2) & 1;
+				const Voxel *voxel = getVoxel(x0 + dx, y0 + dy, z0 + dz);
+				if(!voxel)
+					return false;
+
+				const double w = (dx ? fx : 1.0 - fx) * (dy ? fy : 1.0 - fy) * (dz ? fz : 1.0 - fz);
+				tsdf += w * voxel->tsdf_;
+				if(color)
+					*color += w * voxel->color_;
+			}
+			return true;
+		}
+
+	private:
+		const Volume &volume_;
+		const int resolution_;
+
+		const VolumeUnit *lastUnit_{ nullptr };
+		Eigen::Vector3i lastUnitIndex_;
+		bool hasLastUnit_{ false };
+	};
+
+	/**
+	 * Ray parameter at which origin + t * dir leaves the volume unit with the given index.
+	 */
+	double computeUnitExit(const Eigen::Vector3d &origin, const Eigen::Vector3d &dir,
+		const Eigen::Vector3i &unitIndex, double unitLength)
+	{
+		double tExit = std::numeric_limits<double>::infinity();
+		for(int axis = 0; axis < 3; axis++)
+		{
+			if(std::abs(dir(axis)) < 1e-12)
+				continue;
+
+			const double bound = (unitIndex(axis) + (dir(axis) > 0 ? 1 : 0)) * unitLength;
+			tExit = std::min(tExit, (bound - origin(axis)) / dir(axis));
+		}
+		return tExit;
+	}
+}
+
+size_t TSDFRaycaster::raycast(const open3d::pipelines::integration::ScalableTSDFVolume &volume,
+	const open3d::camera::PinholeCameraIntrinsic &intrinsic, const Eigen::Matrix4d &extrinsic,
+	double minDepth, double maxDepth, open3d::geometry::RGBDImage &rgbdImage)
+{
+	const int width = intrinsic.width_, height = intrinsic.height_;
+	rgbdImage.color_.Prepare(width, height, 3, 1);
+	rgbdImage.depth_.Prepare(width, height, 1, 4);
+
+	const Eigen::Matrix3d &K = intrinsic.intrinsic_matrix_;
+	const double fx = K(0, 0), fy = K(1, 1), cx = K(0, 2), cy = K(1, 2);
+
+	const Eigen::Matrix4d cameraToWorld = extrinsic.inverse();
+	const Eigen::Matrix3d R = cameraToWorld.block<3, 3>(0, 0);
+	const Eigen::Vector3d origin = cameraToWorld.block<3, 1>(0, 3);
+
+	const double voxelLength = volume.voxel_length_;
+	const double unitLength = volume.volume_unit_length_;
+	const double sdfTrunc = volume.sdf_trunc_;
+	const double tStart = std::max(minDepth, voxelLength);
+
+	long long numHits = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:numHits)
+#endif
+	for(int y = 0; y < height; y++)
+	{
+		VoxelLookup lookup(volume);
+		float *pDepth = rgbdImage.depth_.PointerAt<float>(0, y);
+		uint8_t *pColor = rgbdImage.color_.PointerAt<uint8_t>(0, y, 0);
+
+		for(int x = 0; x < width; x++, pColor += 3)
+		{
+			pDepth[x] = 0;
+			pColor[0] = pColor[1] = pColor[2] = 0;
+
+			// Scaled so that t is the depth along the camera's z axis
+			const Eigen::Vector3d dir = R * Eigen::Vector3d((x - cx) / fx, (y - cy) / fy, 1.0);
+
+			double t = tStart, tPrev = 0, tsdfPrev = 0;
+			bool hasPrev = false;
+			while(t < maxDepth)
+			{
+				const Eigen::Vector3d p = origin + t * dir;
+				const Eigen::Vector3i unitIndex(static_cast<int>(std::floor(p(0) / unitLength)),
+					static_cast<int>(std::floor(p(1) / unitLength)),
+					static_cast<int>(std::floor(p(2) / unitLength)));
+
+				// Nothing was integrated here, skip the whole unit
+				if(!lookup.getUnit(unitIndex))
+				{
+					t = std::max(t + 0.01 * voxelLength, computeUnitExit(origin, dir, unitIndex, unitLength) + 1e-6);
+					hasPrev = false;
+					continue;
+				}
+
+				double tsdf;
+				if(!lookup.interpolate(p, tsdf, nullptr))
+				{
+					t += voxelLength;
+					hasPrev = false;
+					continue;
+				}
+
+				if(hasPrev && tsdfPrev > 0 && tsdf <= 0)
+				{
+					// Zero crossing from the front, interpolate linearly between the samples
+					const double tHit = tPrev + (t - tPrev) * tsdfPrev / (tsdfPrev - tsdf);
+					double tsdfHit;
+					Eigen::Vector3d color;
+					if(lookup.interpolate(origin + tHit * dir, tsdfHit, &color))
+					{
+						pDepth[x] = static_cast<float>(tHit);
+						for(int c = 0; c < 3; c++)
+							pColor[c] = static_cast<uint8_t>(std::min(std::max(color(c), 0.0), 255.0) + 0.5);
+						numHits++;
+					}
+					break;
+				}
+				if(hasPrev && tsdfPrev < 0 && tsdf > 0)
+					break;	// Back side of a surface
+
+				tPrev = t;
+				tsdfPrev = tsdf;
+				hasPrev = true;
+				t += std::max(voxelLength, 0.8 * tsdf * sdfTrunc);
+			}
+		}
+	}
+
+	return static_cast<size_t>(numHits);
+}
@@ -0,0 +1,30 @@
+#ifndef TSDFRAYCASTER_H
+#define TSDFRAYCASTER_H
+
+#include "open3d/Open3D.h"
+
+#include <cstddef>
+
+/**
+ * Renders a view of a ScalableTSDFVolume by casting a ray through each pixel.
+ *
+ * The result is a synthetic RGBD image of the model, used by the stitcher to
+ * register the live frame against the model instead of the previous frame.
+ */
+class TSDFRaycaster
+{
+public:
+	/**
+	 * Renders depth (float, in metres, 0 where no surface was hit) and color (RGB8)
+	 * of the volume as seen by a camera with the given intrinsic and extrinsic.
+	 *
+	 * The volume must not be modified during the call.
+	 *
+	 * @return Number of pixels with a surface.
+	 */
+	static size_t raycast(const open3d::pipelines::integration::ScalableTSDFVolume &volume,
+		const open3d::camera::PinholeCameraIntrinsic &intrinsic, const Eigen::Matrix4d &extrinsic,
+		double minDepth, double maxDepth, open3d::geometry::RGBDImage &rgbdImage);
+};
+
+#endif
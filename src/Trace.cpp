@@ -0,0 +1,203 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+std::atomic<bool> Trace::enabled_{ false };
+
+/**
+ * The events of one thread. The mutex is only contended while the events are written out.
+ */
+struct Trace::ThreadBuffer
+{
+	std::mutex mutex;
+	std::vector<Event> events;	// Grows up to eventsPerThread, then wraps around
+	size_t nextEvent{ 0 };
+	int threadId{ 0 };
+	std::string threadName;
+	std::atomic<bool> isFinished{ false };
+};
+
+/**
+ * What a thread knows about itself; releases its buffer when the thread exits.
+ */
+struct Trace::ThreadState
+{
+	std::string name;
+	std::shared_ptr<ThreadBuffer> buffer;
+
+	~ThreadState()
+	{
+		if(buffer)
+			buffer->isFinished = true;
+	}
+};
+
+std::mutex Trace::registryMutex_;
+std::vector<std::shared_ptr<Trace::ThreadBuffer> > Trace::registry_;
+int Trace::nextThreadId_ = 1;
+
+static const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+uint64_t Trace::now()
+{
+	// Offset by one, so 0 can mark a scope that started while tracing was off
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - traceEpoch).count()) + 1;
+}
+
+Trace::ThreadState &Trace::getThreadState()
+{
+	thread_local ThreadState state;
+	return state;
+}
+
+/**
+ * Created on the first event of the thread, or taken over from a finished thread of the same name.
+ */
+Trace::ThreadBuffer &Trace::getThreadBuffer()
+{
+	ThreadState &state = getThreadState();
+	if(!state.buffer)
+	{
+		std::unique_lock<std::mutex> lock(registryMutex_);
+		if(!state.name.empty())
+		{
+			for(const auto &buffer : registry_)
+			{
+				std::unique_lock<std::mutex> bufferLock(buffer->mutex);
+				if(buffer->isFinished && buffer->threadName == state.name)
+				{
+					buffer->isFinished = false;
+					state.buffer = buffer;
+					break;
+				}
+			}
+		}
+		if(!state.buffer)
+		{
+			state.buffer = std::make_shared<ThreadBuffer>();
+			state.buffer->threadName = state.name;
+			state.buffer->threadId = nextThreadId_++;
+			registry_.push_back(state.buffer);
+		}
+	}
+	return *state.buffer;
+}
+
+void Trace::record(const char *name, uint64_t startTime, uint64_t endTime)
+{
+	ThreadBuffer &buffer = getThreadBuffer();
+	std::unique_lock<std::mutex> lock(buffer.mutex);
+
+	const Event event = { name, startTime, endTime };
+	if(buffer.events.size() < eventsPerThread)
+		buffer.events.push_back(event);
+	else
+		buffer.events[buffer.nextEvent] = event;
+	buffer.nextEvent = (buffer.nextEvent + 1) % eventsPerThread;
+}
+
+void Trace::setThreadName(const std::string &name)
+{
+	ThreadState &state = getThreadState();
+	state.name = name;
+	if(state.buffer)
+	{
+		std::unique_lock<std::mutex> lock(state.buffer->mutex);
+		state.buffer->threadName = name;
+	}
+}
+
+void Trace::removeFinishedBuffers(bool keepNamed)
+{
+	std::unique_lock<std::mutex> lock(registryMutex_);
+	registry_.erase(std::remove_if(registry_.begin(), registry_.end(),
+		[keepNamed](const std::shared_ptr<ThreadBuffer> &buffer)
+		{
+			std::unique_lock<std::mutex> bufferLock(buffer->mutex);
+			return buffer->isFinished && !(keepNamed && !buffer->threadName.empty());
+		}), registry_.end());
+}
+
+static void writeJSONString(std::ostream &out, const std::string &value)
+{
+	out << '"';
+	for(char c : value)
+	{
+		if(c == '"' || c == '\\')
+			out << '\\';
+		out << c;
+	}
+	out << '"';
+}
+
+bool Trace::writeChromeTrace(const std::string &filename)
+{
+	std::vector<std::shared_ptr<ThreadBuffer> > buffers;
+	{
+		std::unique_lock<std::mutex> lock(registryMutex_);
+		buffers = registry_;
+	}
+
+	std::ofstream file(filename);
+	if(!file)
+		return false;
+
+	file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	file << std::fixed << std::setprecision(3);
+	bool isFirst = true;
+	for(const auto &buffer : buffers)
+	{
+		// Copied, so the thread is only blocked for a moment
+		std::vector<Event> events;
+		std::string threadName;
+		{
+			std::unique_lock<std::mutex> lock(buffer->mutex);
+			events = buffer->events;
+			threadName = buffer->threadName;
+		}
+
+		if(!threadName.empty())
+		{
+			file << (isFirst ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+				<< buffer->threadId << ", \"args\": {\"name\": ";
+			writeJSONString(file, threadName);
+			file << "}}";
+			isFirst = false;
+		}
+
+		for(const Event &event : events)
+		{
+			file << (isFirst ? "\n" : ",\n") << "{\"name\": ";
+			writeJSONString(file, event.name);
+			file << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadId
+				<< ", \"ts\": " << static_cast<double>(event.startTime) / 1000.0
+				<< ", \"dur\": " << static_cast<double>(event.endTime - event.startTime) / 1000.0 << "}";
+			isFirst = false;
+		}
+	}
+	file << "\n]}" << std::endl;
+
+	removeFinishedBuffers(true);
+	return static_cast<bool>(file);
+}
+
+void Trace::clear()
+{
+	std::vector<std::shared_ptr<ThreadBuffer> > buffers;
+	{
+		std::unique_lock<std::mutex> lock(registryMutex_);
+		buffers = registry_;
+	}
+
+	for(const auto &buffer : buffers)
+	{
+		std::unique_lock<std::mutex> lock(buffer->mutex);
+		buffer->events.clear();
+		buffer->nextEvent = 0;
+	}
+	removeFinishedBuffers(false);
+}
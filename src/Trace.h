@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Scoped trace events, to see how the threads interleave.
+ *
+ * Each thread records into a ring buffer of its own, so recording an event
+ * never waits on another thread; only the most recent events of each thread
+ * are kept. The events of all threads can be written at any time as a
+ * Chrome trace (JSON), which chrome://tracing and Perfetto display.
+ *
+ * Tracing is off by default; then a scope costs a single atomic load.
+ */
+class Trace
+{
+public:
+	/**
+	 * Records the time from its construction to its destruction as one event.
+	 *
+	 * The name is not copied and must be a string literal.
+	 */
+	class Scope
+	{
+	public:
+		explicit Scope(const char *name)
+			: name_(name), startTime_(isEnabled() ? now() : 0)
+		{
+		}
+		~Scope()
+		{
+			if(startTime_ != 0)
+				record(name_, startTime_, now());
+		}
+
+		Scope(const Scope&) = delete;
+		Scope &operator=(const Scope&) = delete;
+
+	private:
+		const char *name_;
+		uint64_t startTime_;
+	};
+
+	static void setEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+	static bool isEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+	/**
+	 * Name of the calling thread in the trace. A thread that takes the name of a
+	 * finished one continues its events, so restarted stages show up as one row.
+	 *
+	 * Nothing is allocated until the thread records its first event.
+	 */
+	static void setThreadName(const std::string &name);
+
+	/**
+	 * Writes the recorded events of all threads in the Chrome trace event format.
+	 */
+	static bool writeChromeTrace(const std::string &filename);
+
+	/**
+	 * Discards the recorded events and the buffers of finished threads.
+	 */
+	static void clear();
+
+	static const size_t eventsPerThread = 16384;
+
+private:
+	struct Event
+	{
+		const char *name;
+		uint64_t startTime, endTime;	// Nanoseconds, never 0
+	};
+	struct ThreadBuffer;
+	struct ThreadState;
+
+	static uint64_t now();
+	static void record(const char *name, uint64_t startTime, uint64_t endTime);
+	static ThreadState &getThreadState();
+	static ThreadBuffer &getThreadBuffer();
+	static void removeFinishedBuffers(bool keepNamed);
+
+	static std::atomic<bool> enabled_;
+
+	// Buffers outlive their threads, so the events of finished stages can still be
+	// written. Named ones are reused by the next thread of that name, unnamed
+	// ones are dropped once written.
+	static std::mutex registryMutex_;
+	static std::vector<std::shared_ptr<ThreadBuffer> > registry_;
+	static int nextThreadId_;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+/**
+ * Traces the rest of the enclosing block under the given name (a string literal).
+ */
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif
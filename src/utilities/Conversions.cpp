@@ -1,10 +1,13 @@
 
 #include "Conversions.h"
+#include "../DepthToPointCloud.h"
 
 #include <osg/Geometry>
 #include <osg/ShadeModel>
 #include <osg/Material>
 
+#include <cstring>
+
 
 osg::ref_ptr<osg::Group> Conversions::convertOpen3DToOSG(const std::shared_ptr<open3d::geometry::TriangleMesh> triangleMesh1)
 {
@@ -72,7 +75,7 @@ osg::ref_ptr<osg::Group> Conversions::convertOpen3DToOSG(const std::shared_ptr<o
 	return root;
 }
 
-osg::ref_ptr<osg::Group> Conversions::convertOpen3DToOSG(const std::shared_ptr<open3d::geometry::PointCloud> pointCloud)
+osg::ref_ptr<osg::Group> Conversions::convertOpen3DToOSG(const std::shared_ptr<const open3d::geometry::PointCloud> pointCloud)
 {
 	osg::ref_ptr<osg::Group> root(new osg::Group);
 	osg::ref_ptr<osg::Geode> geode(new osg::Geode());
@@ -128,3 +131,127 @@ osg::ref_ptr<osg::Group> Conversions::convertOpen3DToOSG(const std::shared_ptr<o
 
 	return root;
 }
+
+osg::ref_ptr<osg::Group> Conversions::createDynamicPointCloud()
+{
+	osg::ref_ptr<osg::Group> root(new osg::Group);
+	osg::ref_ptr<osg::Geode> geode(new osg::Geode());
+	osg::ref_ptr<osg::Geometry> geometry(new osg::Geometry());
+
+	osg::ref_ptr<osg::Vec3Array> vertices(new osg::Vec3Array());
+	osg::ref_ptr<osg::Vec4ubArray> colors(new osg::Vec4ubArray());
+	osg::ref_ptr<osg::DrawArrays> drawArrays(new osg::DrawArrays(osg::PrimitiveSet::POINTS, 0, 0));
+
+	vertices->setDataVariance(osg::Object::DYNAMIC);
+	geometry->setVertexArray(vertices.get());
+	geometry->setDataVariance(osg::Object::DYNAMIC);
+	geometry->setUseDisplayList(false);
+	geometry->setUseVertexBufferObjects(true);
+
+	colors->setDataVariance(osg::Object::DYNAMIC);
+	colors->setBinding(osg::Array::BIND_PER_VERTEX);
+	colors->setNormalize(true);
+	geometry->setColorArray(colors.get());
+	geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+
+	drawArrays->setDataVariance(osg::Object::DYNAMIC);
+	geometry->addPrimitiveSet(drawArrays.get());
+
+	geode->addDrawable(geometry.get());
+
+	osg::StateSet* stateSet = geode->getOrCreateStateSet();
+	stateSet->setMode(GL_DEPTH_TEST, osg::StateAttribute::OFF);
+	stateSet->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+
+	root->addChild(geode.get());
+
+	return root;
+}
+
+namespace
+{
+	/**
+	 * Finds the arrays of a node created by Conversions::createDynamicPointCloud().
+	 */
+	bool getDynamicPointCloudArrays(osg::Group *root, osg::Geometry *&geometry,
+		osg::Vec3Array *&vertices, osg::Vec4ubArray *&colors, osg::DrawArrays *&drawArrays)
+	{
+		osg::Geode *geode = (root != nullptr && root->getNumChildren() > 0) ? root->getChild(0)->asGeode() : nullptr;
+		geometry = (geode != nullptr && geode->getNumDrawables() > 0) ? dynamic_cast<osg::Geometry *>(geode->getDrawable(0)) : nullptr;
+		if (geometry == nullptr || geometry->getNumPrimitiveSets() == 0)
+			return false;
+
+		vertices = dynamic_cast<osg::Vec3Array *>(geometry->getVertexArray());
+		colors = dynamic_cast<osg::Vec4ubArray *>(geometry->getColorArray());
+		drawArrays = dynamic_cast<osg::DrawArrays *>(geometry->getPrimitiveSet(0));
+		return (vertices != nullptr && colors != nullptr && drawArrays != nullptr);
+	}
+
+	void dirtyDynamicPointCloud(osg::Geometry *geometry,
+		osg::Vec3Array *vertices, osg::Vec4ubArray *colors, osg::DrawArrays *drawArrays)
+	{
+		drawArrays->setCount(static_cast<GLsizei>(vertices->size()));
+
+		vertices->dirty();
+		colors->dirty();
+		drawArrays->dirty();
+		geometry->dirtyBound();
+	}
+}
+
+bool Conversions::updateDynamicPointCloud(osg::Group *root, const std::shared_ptr<const open3d::geometry::PointCloud> pointCloud)
+{
+	osg::Geometry *geometry = nullptr;
+	osg::Vec3Array *vertices = nullptr;
+	osg::Vec4ubArray *colors = nullptr;
+	osg::DrawArrays *drawArrays = nullptr;
+	if (!getDynamicPointCloudArrays(root, geometry, vertices, colors, drawArrays))
+		return false;
+
+	const size_t numVertices = pointCloud ? pointCloud->points_.size() : 0;
+	vertices->resize(numVertices);
+	colors->resize(numVertices);
+
+	for (size_t j = 0; j < numVertices; j++)
+	{
+		const auto& vec = pointCloud->points_[j];
+		(*vertices)[j].set(vec.x(), vec.y(), vec.z());
+
+		const auto& color = pointCloud->colors_[j];
+		(*colors)[j].set(static_cast<unsigned char>(color.x() * 255.0),
+			static_cast<unsigned char>(color.y() * 255.0),
+			static_cast<unsigned char>(color.z() * 255.0), 255);
+	}
+
+	dirtyDynamicPointCloud(geometry, vertices, colors, drawArrays);
+
+	return true;
+}
+
+bool Conversions::updateDynamicPointCloud(osg::Group *root, const std::shared_ptr<const PointCloudSoA> pointCloud)
+{
+	osg::Geometry *geometry = nullptr;
+	osg::Vec3Array *vertices = nullptr;
+	osg::Vec4ubArray *colors = nullptr;
+	osg::DrawArrays *drawArrays = nullptr;
+	if (!getDynamicPointCloudArrays(root, geometry, vertices, colors, drawArrays))
+		return false;
+
+	const size_t numVertices = pointCloud ? pointCloud->size() : 0;
+	vertices->resize(numVertices);
+	colors->resize(numVertices);
+
+	if (numVertices > 0)
+	{
+		const float *pX = pointCloud->getX(), *pY = pointCloud->getY(), *pZ = pointCloud->getZ();
+		for (size_t j = 0; j < numVertices; j++)
+			(*vertices)[j].set(pX[j], pY[j], pZ[j]);
+
+		// osg::Vec4ub has the same R, G, B, A byte layout as the packed colors
+		memcpy(&(*colors)[0], pointCloud->getRGBA(), numVertices * sizeof(uint32_t));
+	}
+
+	dirtyDynamicPointCloud(geometry, vertices, colors, drawArrays);
+
+	return true;
+}
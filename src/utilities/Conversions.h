@@ -7,6 +7,8 @@
 
 #include <osg/Geode>
 
+class PointCloudSoA;
+
 /**
  *
  */
@@ -14,7 +16,22 @@ class Conversions
 {
 public:
 	static osg::ref_ptr<osg::Group> convertOpen3DToOSG(const std::shared_ptr<open3d::geometry::TriangleMesh> triangleMesh);
-	static osg::ref_ptr<osg::Group> convertOpen3DToOSG(const std::shared_ptr<open3d::geometry::PointCloud> triangleMesh);
+	static osg::ref_ptr<osg::Group> convertOpen3DToOSG(const std::shared_ptr<const open3d::geometry::PointCloud> triangleMesh);
+
+	/**
+	 * Creates an empty point cloud node meant to be updated with updateDynamicPointCloud().
+	 */
+	static osg::ref_ptr<osg::Group> createDynamicPointCloud();
+
+	/**
+	 * Replaces the points of a node created by createDynamicPointCloud().
+	 *
+	 * The vertex and color arrays are updated in place and marked dirty, so only
+	 * the buffer contents are uploaded again. Must be called from the thread
+	 * rendering the node. Returns false if root was not created by createDynamicPointCloud().
+	 */
+	static bool updateDynamicPointCloud(osg::Group *root, const std::shared_ptr<const open3d::geometry::PointCloud> pointCloud);
+	static bool updateDynamicPointCloud(osg::Group *root, const std::shared_ptr<const PointCloudSoA> pointCloud);
 
 };
 #endif // !CONVERSIONS_H